@@ -8,6 +8,8 @@
 #define ChangedResource			Pomme_ChangedResource
 #define ClearPortDamage			Pomme_ClearPortDamage
 #define CloseResFile			Pomme_CloseResFile
+#define CompactMem				Pomme_CompactMem
+#define CompactMemSys			Pomme_CompactMemSys
 #define CopyBits				Pomme_CopyBits
 #define Count1Resources			Pomme_Count1Resources
 #define Count1Types				Pomme_Count1Types
@@ -20,6 +22,7 @@
 #define DisposePtr				Pomme_DisposePtr
 #define DrawChar				Pomme_DrawChar
 #define DrawPicture				Pomme_DrawPicture
+#define EmptyHandle				Pomme_EmptyHandle
 #define EraseRect				Pomme_EraseRect
 #define ExitToShell				Pomme_ExitToShell
 #define FSClose					Pomme_FSClose
@@ -60,9 +63,17 @@
 #define GetSoundHeaderOffset	Pomme_GetSoundHeaderOffset
 #define GetWindowPort			Pomme_GetWindowPort
 #define HideCursor				Pomme_HideCursor
+#define HLock					Pomme_HLock
+#define HLockHi					Pomme_HLockHi
+#define HNoPurge				Pomme_HNoPurge
+#define HPurge					Pomme_HPurge
+#define HUnlock					Pomme_HUnlock
 #define InitCursor				Pomme_InitCursor
 #define IsPortDamaged			Pomme_IsPortDamaged
 #define LineTo					Pomme_LineTo
+#define LoadResource			Pomme_LoadResource
+#define MaxMem					Pomme_MaxMem
+#define MemError				Pomme_MemError
 #define Microseconds			Pomme_Microseconds
 #define MoveTo					Pomme_MoveTo
 #define NewGWorld				Pomme_NewGWorld
@@ -76,7 +87,10 @@
 #define PenNormal				Pomme_PenNormal
 #define PenSize					Pomme_PenSize
 #define PtrToHand				Pomme_PtrToHand
+#define PurgeMem				Pomme_PurgeMem
+#define PurgeMemSys				Pomme_PurgeMemSys
 #define QDError					Pomme_QDError
+#define ReallocateHandle		Pomme_ReallocateHandle
 #define RGBBackColor			Pomme_RGBBackColor
 #define RGBForeColor			Pomme_RGBForeColor
 #define ReleaseResource			Pomme_ReleaseResource
@@ -0,0 +1,537 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/ArchiveVolume.h"
+#include "Memory/PageAllocator.h"
+#include "Utilities/bigendianstreams.h"
+#include "Utilities/LZ.h"
+#include "Utilities/memstream.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "ARCH")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+static constexpr UInt32 kArchiveMagic = 'PMAR';
+static constexpr UInt16 kArchiveVersion = 1;
+static constexpr size_t kArchiveHeaderSize = 4 + 2 + 2 + 8 + 4;
+
+//-----------------------------------------------------------------------------
+// Fork handle
+
+// The bytes of an archived fork: a private view of the archive if the fork is stored as-is,
+// or a decompressed copy otherwise.
+struct ArchivedForkBytes
+{
+	char* view;
+	size_t viewSize;
+	std::vector<char> inflated;
+	std::span<char> bytes;
+
+	ArchivedForkBytes(intptr_t archiveFile, const ArchiveVolume::Fork& fork)
+		: view(nullptr)
+		, viewSize(0)
+	{
+		if (fork.size == 0)
+			return;
+
+		char* stored = Memory::PageAllocator::MapFileView(archiveFile, fork.offset, fork.storedSize);
+		if (!stored)
+			throw std::runtime_error("ArchiveVolume: can't map fork");
+
+		if (fork.codec == ArchiveVolume::kCodecStored)
+		{
+			view = stored;
+			viewSize = fork.storedSize;
+			bytes = std::span<char>(view, fork.size);
+			return;
+		}
+
+		try
+		{
+			inflated.resize(fork.size);
+			LZ::Decompress(std::span<const char>(stored, fork.storedSize), inflated);
+		}
+		catch (...)
+		{
+			Memory::PageAllocator::UnmapFileView(stored, fork.storedSize);
+			throw;
+		}
+
+		Memory::PageAllocator::UnmapFileView(stored, fork.storedSize);
+		bytes = inflated;
+	}
+
+	~ArchivedForkBytes()
+	{
+		if (view)
+			Memory::PageAllocator::UnmapFileView(view, viewSize);
+	}
+
+	ArchivedForkBytes(const ArchivedForkBytes&) = delete;
+	ArchivedForkBytes& operator=(const ArchivedForkBytes&) = delete;
+};
+
+// Read-only fork living in an archive. Its entire contents are in memory, so GetMappedBytes gives zero-copy access.
+struct ArchiveForkHandle : public ForkHandle
+{
+	intptr_t archiveFile;
+	ArchiveVolume::Fork fork;
+	ArchivedForkBytes contents;		// must be initialized before the stream
+	memstream stream;
+
+public:
+	ArchiveForkHandle(ForkType theForkType, char perm, const FSSpec& theSpec, intptr_t theArchiveFile, const ArchiveVolume::Fork& theFork)
+		: ForkHandle(theForkType, perm, theSpec)
+		, archiveFile(theArchiveFile)
+		, fork(theFork)
+		, contents(theArchiveFile, theFork)
+		, stream(contents.bytes.data(), contents.bytes.size())
+	{
+	}
+
+	virtual ~ArchiveForkHandle() = default;
+
+	virtual std::iostream& GetStream() override
+	{
+		return stream;
+	}
+
+	virtual std::span<char> GetMappedBytes() override
+	{
+		return contents.bytes;
+	}
+
+	virtual char* MapView(std::streamoff offset, size_t size) override
+	{
+		// Only forks stored as-is can be viewed straight from the archive
+		if (fork.codec != ArchiveVolume::kCodecStored)
+			return nullptr;
+
+		if (offset < 0 || size == 0 || uint64_t(offset) > fork.size || size > fork.size - size_t(offset))
+			return nullptr;
+
+		return Memory::PageAllocator::MapFileView(archiveFile, fork.offset + uint64_t(offset), size);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Archive index
+
+ArchiveVolume::ArchiveVolume(short vRefNum, const fs::path& archivePath)
+	: IndexedVolume(vRefNum)
+{
+	size_t size = 0;
+	archiveFile = Memory::PageAllocator::OpenMappableFile(archivePath, size);
+	archiveSize = size;
+
+	if (archiveFile == -1)
+	{
+		throw std::runtime_error("ArchiveVolume: can't open archive");
+	}
+
+	try
+	{
+		ReadIndex();
+	}
+	catch (...)
+	{
+		Memory::PageAllocator::CloseMappableFile(archiveFile);
+		throw;
+	}
+
+	LOG << archivePath << ": " << GetNumDirectories() << " directories, " << files.size() << " files\n";
+}
+
+ArchiveVolume::~ArchiveVolume()
+{
+	Memory::PageAllocator::CloseMappableFile(archiveFile);
+}
+
+static u8string ReadName(BigEndianIStream& f)
+{
+	std::string name(f.Read<UInt16>(), '\0');
+	f.Read(name.data(), name.size());
+	return u8string(name.begin(), name.end());
+}
+
+void ArchiveVolume::ReadIndex()
+{
+	if (archiveSize < kArchiveHeaderSize)
+	{
+		throw std::runtime_error("ArchiveVolume: archive too small");
+	}
+
+	// Header
+	UInt64 indexOffset;
+	UInt32 indexSize;
+	{
+		char* header = Memory::PageAllocator::MapFileView(archiveFile, 0, kArchiveHeaderSize);
+		if (!header)
+			throw std::runtime_error("ArchiveVolume: can't map header");
+
+		memstream headerStream(header, kArchiveHeaderSize);
+		auto f = BigEndianIStream(headerStream);
+		UInt32 magic = f.Read<UInt32>();
+		UInt16 version = f.Read<UInt16>();
+		f.Skip(2);
+		indexOffset = f.Read<UInt64>();
+		indexSize = f.Read<UInt32>();
+
+		Memory::PageAllocator::UnmapFileView(header, kArchiveHeaderSize);
+
+		if (magic != kArchiveMagic)
+			throw std::runtime_error("ArchiveVolume: not an archive");
+		if (version != kArchiveVersion)
+			throw std::runtime_error("ArchiveVolume: unsupported archive version");
+		if (indexSize == 0 || indexOffset > archiveSize || indexSize > archiveSize - indexOffset)
+			throw std::runtime_error("ArchiveVolume: index out of bounds");
+	}
+
+	// Index
+	char* index = Memory::PageAllocator::MapFileView(archiveFile, indexOffset, indexSize);
+	if (!index)
+		throw std::runtime_error("ArchiveVolume: can't map index");
+
+	try
+	{
+		memstream indexStream(index, indexSize);
+		auto f = BigEndianIStream(indexStream);
+
+		UInt32 numDirectories = f.Read<UInt32>();
+		if (numDirectories == 0)
+			throw std::runtime_error("ArchiveVolume: no root directory");
+
+		f.Skip(4);			// root's parent
+		ReadName(f);		// root's name
+
+		for (UInt32 i = 1; i < numDirectories; i++)
+		{
+			UInt32 parent = f.Read<UInt32>();
+			if (parent >= i)
+				throw std::runtime_error("ArchiveVolume: directory precedes its parent");
+
+			AddDirectory(parent, ReadName(f));
+		}
+
+		UInt32 numFiles = f.Read<UInt32>();
+		for (UInt32 i = 0; i < numFiles; i++)
+		{
+			UInt32 parent = f.Read<UInt32>();
+			AddFile(parent, ReadName(f), i);
+
+			File file;
+			for (auto& fork : file.forks)
+			{
+				fork.flags = f.Read<Byte>();
+				fork.codec = f.Read<Byte>();
+				fork.offset = f.Read<UInt64>();
+				fork.storedSize = f.Read<UInt32>();
+				fork.size = f.Read<UInt32>();
+
+				if (!(fork.flags & kForkPresent))
+					continue;
+
+				if (fork.offset > archiveSize || fork.storedSize > archiveSize - fork.offset)
+					throw std::runtime_error("ArchiveVolume: fork out of bounds");
+				if (fork.codec != kCodecStored && fork.codec != kCodecLZ)
+					throw std::runtime_error("ArchiveVolume: unsupported codec");
+				if (fork.codec == kCodecStored && fork.storedSize != fork.size)
+					throw std::runtime_error("ArchiveVolume: bad stored fork size");
+			}
+
+			files.push_back(file);
+		}
+	}
+	catch (...)
+	{
+		Memory::PageAllocator::UnmapFileView(index, indexSize);
+		throw;
+	}
+
+	Memory::PageAllocator::UnmapFileView(index, indexSize);
+}
+
+OSErr ArchiveVolume::OpenFileFork(UInt32 fileIndex, const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle)
+{
+	const Fork& fork = files.at(fileIndex).forks[forkType];
+	if (!(fork.flags & kForkPresent))
+	{
+		return fnfErr;
+	}
+
+	handle = std::make_unique<ArchiveForkHandle>(forkType, permission, *spec, archiveFile, fork);
+	return noErr;
+}
+
+//-----------------------------------------------------------------------------
+// Packer
+
+struct PackedFile
+{
+	UInt32 parent;
+	u8string name;
+	fs::path sources[2];		// host file holding each fork, indexed by ForkType
+};
+
+struct PackedDirectory
+{
+	UInt32 parent;
+	u8string name;
+	std::unordered_map<u8string, size_t> files;		// uppercased name -> index into the packed files
+	std::unordered_set<u8string> subdirectories;	// uppercased names
+};
+
+// Finds the resource fork in an AppleDouble file. Returns false if the file isn't AppleDouble.
+static bool FindAppleDoubleResourceFork(std::istream& stream, UInt32& offset, UInt32& length)
+{
+	auto f = BigEndianIStream(stream);
+
+	try
+	{
+		if (0x0005160700020000ULL != f.Read<UInt64>())
+			return false;
+
+		f.Skip(16);
+		auto numOfEntries = f.Read<UInt16>();
+
+		for (int i = 0; i < numOfEntries; i++)
+		{
+			auto entryID = f.Read<UInt32>();
+			offset = f.Read<UInt32>();
+			length = f.Read<UInt32>();
+			if (entryID == 2)
+				return true;
+		}
+	}
+	catch (const std::out_of_range&)
+	{
+	}
+
+	return false;
+}
+
+static std::vector<char> ReadForkFromHost(const fs::path& path, ForkType forkType)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("ArchiveVolume::Pack: can't read " + path.string());
+
+	UInt64 offset = 0;
+	UInt64 length = fs::file_size(path);
+
+	if (forkType == ResourceFork)
+	{
+		UInt32 adfOffset = 0;
+		UInt32 adfLength = 0;
+		if (!FindAppleDoubleResourceFork(file, adfOffset, adfLength) || UInt64(adfOffset) + adfLength > length)
+			throw std::runtime_error("ArchiveVolume::Pack: bad AppleDouble file " + path.string());
+		offset = adfOffset;
+		length = adfLength;
+	}
+
+	if (length > 0xFFFFFFFFull)
+		throw std::runtime_error("ArchiveVolume::Pack: fork too large " + path.string());
+
+	std::vector<char> bytes(length);
+	file.clear();
+	file.seekg(offset, std::ios::beg);
+	file.read(bytes.data(), bytes.size());
+	if (!file)
+		throw std::runtime_error("ArchiveVolume::Pack: can't read " + path.string());
+
+	return bytes;
+}
+
+static void WriteName(BigEndianOStream& f, const u8string& name)
+{
+	if (name.length() > 255)
+		throw std::runtime_error("ArchiveVolume::Pack: name too long");
+	if (name.find(':') != u8string::npos)
+		throw std::runtime_error("ArchiveVolume::Pack: name contains a colon");
+
+	f.Write<UInt16>(UInt16(name.length()));
+	f.Write((const char*) name.data(), name.length());
+}
+
+void ArchiveVolume::Pack(const fs::path& sourceDirectory, const fs::path& archivePath, bool compress)
+{
+	if (!fs::is_directory(sourceDirectory))
+	{
+		throw std::runtime_error("ArchiveVolume::Pack: source isn't a directory");
+	}
+
+	std::vector<PackedDirectory> packedDirectories;
+	std::vector<PackedFile> packedFiles;
+
+	packedDirectories.push_back({ 0, u8string(), {}, {} });		// root
+
+	// Gather the tree. Entries are sorted so that packing the same tree twice gives the same archive.
+	auto AddDirectory = [&](auto& self, const fs::path& hostDirectory, UInt32 directoryIndex) -> void
+	{
+		std::vector<fs::directory_entry> children(fs::directory_iterator(hostDirectory), fs::directory_iterator{});
+		std::sort(children.begin(), children.end());
+
+		for (const auto& child : children)
+		{
+			fs::path filename = child.path().filename();
+			u8string uppercaseName = UppercaseCopy(filename.u8string());
+
+			// Lookups are case-insensitive, so names that only differ in case would be unreachable once mounted
+			auto ThrowNameCollision = [&]()
+			{
+				throw std::runtime_error("ArchiveVolume::Pack: name collides with another one (ignoring case): " + child.path().string());
+			};
+
+			if (child.is_directory())
+			{
+				auto& directory = packedDirectories[directoryIndex];
+				if (directory.files.find(uppercaseName) != directory.files.end() || !directory.subdirectories.insert(uppercaseName).second)
+					ThrowNameCollision();
+
+				UInt32 childIndex = UInt32(packedDirectories.size());
+				packedDirectories.push_back({ directoryIndex, filename.u8string(), {}, {} });
+				self(self, child.path(), childIndex);
+				continue;
+			}
+
+			std::error_code ec;
+			if (!child.is_regular_file() || fs::equivalent(child.path(), archivePath, ec))
+			{
+				continue;
+			}
+
+			ForkType forkType = DataFork;
+
+			// It might be an AppleDouble resource fork ("file.rsrc")
+			if (filename.extension() == ".rsrc")
+			{
+				std::ifstream file(child.path(), std::ios::binary);
+				UInt32 offset, length;
+				if (FindAppleDoubleResourceFork(file, offset, length))
+				{
+					forkType = ResourceFork;
+					filename.replace_extension("");
+					uppercaseName = UppercaseCopy(filename.u8string());
+				}
+			}
+
+			auto& directory = packedDirectories[directoryIndex];
+			if (directory.subdirectories.find(uppercaseName) != directory.subdirectories.end())
+				ThrowNameCollision();
+
+			auto [it, isNew] = directory.files.emplace(uppercaseName, packedFiles.size());
+			if (isNew)
+			{
+				packedFiles.push_back({ directoryIndex, filename.u8string(), {} });
+			}
+
+			// The data fork and the resource fork of a file may come from two host files, but not more
+			auto& source = packedFiles[it->second].sources[forkType];
+			if (!source.empty())
+				ThrowNameCollision();
+
+			source = child.path();
+		}
+	};
+
+	AddDirectory(AddDirectory, sourceDirectory, 0);
+
+	// Write fork data, then the index
+	std::ofstream out(archivePath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		throw std::runtime_error("ArchiveVolume::Pack: can't write " + archivePath.string());
+	}
+
+	auto f = BigEndianOStream(out);
+
+	f.Write<UInt32>(kArchiveMagic);
+	f.Write<UInt16>(kArchiveVersion);
+	f.Write<UInt16>(0);
+	f.Write<UInt64>(0);		// index offset, filled in below
+	f.Write<UInt32>(0);		// index size, filled in below
+
+	std::vector<std::array<Fork, 2>> packedForks(packedFiles.size());
+
+	for (size_t i = 0; i < packedFiles.size(); i++)
+	{
+		for (int forkType : { DataFork, ResourceFork })
+		{
+			Fork& fork = packedForks[i][forkType];
+			fork = { 0, kCodecStored, 0, 0, 0 };
+
+			const auto& source = packedFiles[i].sources[forkType];
+			if (source.empty())
+				continue;
+
+			auto bytes = ReadForkFromHost(source, ForkType(forkType));
+
+			fork.flags = kForkPresent;
+			fork.offset = UInt64(f.Tell());
+			fork.size = UInt32(bytes.size());
+
+			std::vector<char> compressed;
+			if (compress && !bytes.empty())
+				compressed = LZ::Compress(bytes);
+
+			// Only keep the compressed version if it saves at least 1/8th
+			if (!compressed.empty() && compressed.size() < bytes.size() - bytes.size() / 8)
+			{
+				fork.codec = kCodecLZ;
+				fork.storedSize = UInt32(compressed.size());
+				f.Write(compressed.data(), compressed.size());
+			}
+			else
+			{
+				fork.storedSize = fork.size;
+				f.Write(bytes.data(), bytes.size());
+			}
+
+			LOG << source << ": " << fork.size << " -> " << fork.storedSize << "\n";
+		}
+	}
+
+	UInt64 indexOffset = UInt64(f.Tell());
+
+	f.Write<UInt32>(UInt32(packedDirectories.size()));
+	for (const auto& directory : packedDirectories)
+	{
+		f.Write<UInt32>(directory.parent);
+		WriteName(f, directory.name);
+	}
+
+	f.Write<UInt32>(UInt32(packedFiles.size()));
+	for (size_t i = 0; i < packedFiles.size(); i++)
+	{
+		f.Write<UInt32>(packedFiles[i].parent);
+		WriteName(f, packedFiles[i].name);
+
+		for (const Fork& fork : packedForks[i])
+		{
+			f.Write<Byte>(fork.flags);
+			f.Write<Byte>(fork.codec);
+			f.Write<UInt64>(fork.offset);
+			f.Write<UInt32>(fork.storedSize);
+			f.Write<UInt32>(fork.size);
+		}
+	}
+
+	UInt64 indexEnd = UInt64(f.Tell());
+
+	f.Goto(8);
+	f.Write<UInt64>(indexOffset);
+	f.Write<UInt32>(UInt32(indexEnd - indexOffset));
+
+	out.close();
+	if (!out)
+	{
+		throw std::runtime_error("ArchiveVolume::Pack: error writing " + archivePath.string());
+	}
+}
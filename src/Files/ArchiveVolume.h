@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Files/IndexedVolume.h"
+#include "CompilerSupport/filesystem.h"
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Read-only volume that serves files out of a single pack file, built with ArchiveVolume::Pack.
+	 *
+	 * Pack file layout (all integers big-endian):
+	 *
+	 *   Header:    'PMAR', UInt16 version, UInt16 reserved, UInt64 index offset, UInt32 index size
+	 *   Fork data: the contents of every fork, stored as-is or compressed with Pomme::LZ
+	 *   Index:     UInt32 directory count, then for each directory: UInt32 parent index, name
+	 *              UInt32 file count, then for each file: UInt32 parent index, name, data fork, resource fork
+	 *
+	 * Names are UTF-8, preceded by their UInt16 length. Directory 0 is the root; every other directory
+	 * comes after its parent, so that directory indices match directory IDs.
+	 * Each fork is described by: Byte flags (see ForkFlags), Byte codec (see Codec),
+	 * UInt64 offset of the stored bytes, UInt32 stored size, UInt32 uncompressed size.
+	 * Resource forks are stored raw, without their AppleDouble wrapper.
+	 */
+	class ArchiveVolume : public IndexedVolume
+	{
+	public:
+		enum ForkFlags : Byte
+		{
+			kForkPresent = 1 << 0,
+		};
+
+		enum Codec : Byte
+		{
+			kCodecStored = 0,
+			kCodecLZ = 1,
+		};
+
+		struct Fork
+		{
+			Byte flags;
+			Byte codec;
+			UInt64 offset;
+			UInt32 storedSize;
+			UInt32 size;
+		};
+
+	private:
+		struct File
+		{
+			Fork forks[2];		// indexed by ForkType
+		};
+
+		intptr_t archiveFile;
+		UInt64 archiveSize;
+		std::vector<File> files;
+
+		void ReadIndex();
+
+	protected:
+		OSErr OpenFileFork(UInt32 fileIndex, const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) override;
+
+	public:
+		// Throws std::runtime_error if the archive can't be opened or is malformed.
+		ArchiveVolume(short vRefNum, const fs::path& archivePath);
+
+		virtual ~ArchiveVolume();
+
+		ArchiveVolume(const ArchiveVolume&) = delete;
+		ArchiveVolume& operator=(const ArchiveVolume&) = delete;
+
+		// Packs the contents of a host directory into an archive.
+		// "Foo.rsrc" AppleDouble files become the resource fork of "Foo".
+		// If `compress` is set, forks that compress well are stored compressed.
+		// Throws std::runtime_error on failure.
+		static void Pack(const fs::path& sourceDirectory, const fs::path& archivePath, bool compress);
+	};
+}
@@ -1,10 +1,12 @@
 #include "Pomme.h"
 #include "Utilities/bigendianstreams.h"
-#include "Utilities/GrowablePool.h"
+#include "Utilities/ChunkedPool.h"
 #include "Utilities/memstream.h"
 #include "PommeFiles.h"
 #include "Files/Volume.h"
 #include "Files/HostVolume.h"
+#include "Files/ArchiveVolume.h"
+#include "Files/MemoryVolume.h"
 
 #include <iostream>
 #include <sstream>
@@ -24,7 +26,9 @@ using namespace Pomme::Files;
 //-----------------------------------------------------------------------------
 // State
 
-static Pomme::GrowablePool<std::unique_ptr<ForkHandle>, SInt16, 0x7FFF> openFiles;
+// Up to 1024 open forks. The remaining bits of a refNum hold a generation counter,
+// so that a stale refNum isn't mistaken for a file that was opened later in the same slot.
+static Pomme::ChunkedPool<std::unique_ptr<ForkHandle>, SInt16, 10> openFiles;
 
 static std::vector<std::unique_ptr<Volume>> volumes;
 
@@ -45,6 +49,45 @@ std::iostream& Pomme::Files::GetStream(short refNum)
 	return openFiles[refNum]->GetStream();
 }
 
+std::span<char> Pomme::Files::GetMappedBytes(short refNum)
+{
+	if (!IsRefNumLegal(refNum))
+	{
+		throw std::runtime_error("illegal refNum");
+	}
+	if (!IsStreamOpen(refNum))
+	{
+		return {};
+	}
+	return openFiles[refNum]->GetMappedBytes();
+}
+
+char* Pomme::Files::MapForkView(short refNum, std::streamoff offset, size_t size)
+{
+	if (!IsRefNumLegal(refNum))
+	{
+		throw std::runtime_error("illegal refNum");
+	}
+	if (!IsStreamOpen(refNum))
+	{
+		return nullptr;
+	}
+	return openFiles[refNum]->MapView(offset, size);
+}
+
+fs::path Pomme::Files::GetHostPath(short refNum)
+{
+	if (!IsRefNumLegal(refNum))
+	{
+		throw std::runtime_error("illegal refNum");
+	}
+	if (!IsStreamOpen(refNum))
+	{
+		return {};
+	}
+	return openFiles[refNum]->GetHostPath();
+}
+
 const FSSpec& Pomme::Files::GetSpec(short refNum)
 {
 	if (!IsRefNumLegal(refNum))
@@ -99,6 +142,94 @@ void Pomme::Files::Init()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Archives
+
+OSErr Pomme_MountArchive(const char* hostPath, short* vRefNum)
+{
+	if (volumes.size() >= 32767)
+		return tmfoErr;
+
+	short newVRefNum = (short) volumes.size();
+
+	try
+	{
+		volumes.push_back(std::make_unique<ArchiveVolume>(newVRefNum, fs::path((const char8_t*) hostPath)));
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << __func__ << ": " << hostPath << ": " << e.what() << "\n";
+		return fs::exists(fs::path((const char8_t*) hostPath)) ? ioErr : fnfErr;
+	}
+
+	if (vRefNum)
+		*vRefNum = newVRefNum;
+
+	return noErr;
+}
+
+OSErr Pomme_PackArchive(const char* sourceDirectory, const char* archivePath, Boolean compress)
+{
+	try
+	{
+		ArchiveVolume::Pack(fs::path((const char8_t*) sourceDirectory), fs::path((const char8_t*) archivePath), compress);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << __func__ << ": " << e.what() << "\n";
+		return ioErr;
+	}
+
+	return noErr;
+}
+
+//-----------------------------------------------------------------------------
+// Memory volumes
+
+OSErr Pomme_MountMemoryVolume(short* vRefNum)
+{
+	if (volumes.size() >= 32767)
+		return tmfoErr;
+
+	short newVRefNum = (short) volumes.size();
+	volumes.push_back(std::make_unique<MemoryVolume>(newVRefNum));
+
+	if (vRefNum)
+		*vRefNum = newVRefNum;
+
+	return noErr;
+}
+
+OSErr Pomme_AddMemoryFile(short vRefNum, const char* path, const void* dataFork, long dataForkSize, const void* resourceFork, long resourceForkSize)
+{
+	if (vRefNum < 0 || (unsigned short) vRefNum >= volumes.size())
+		return nsvErr;
+
+	auto* volume = dynamic_cast<MemoryVolume*>(volumes.at(vRefNum).get());
+	if (!volume || !path || dataForkSize < 0 || resourceForkSize < 0)
+		return paramErr;
+
+	try
+	{
+		volume->AddFile(
+			u8string((const char8_t*) path),
+			(const char*) dataFork, dataFork ? size_t(dataForkSize) : 0,
+			(const char*) resourceFork, resourceFork ? size_t(resourceForkSize) : 0);
+	}
+	catch (const std::invalid_argument& e)
+	{
+		std::cerr << __func__ << ": " << path << ": " << e.what() << "\n";
+		return bdNamErr;
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << __func__ << ": " << path << ": " << e.what() << "\n";
+		return dupFNErr;
+	}
+
+	return noErr;
+}
+
 //-----------------------------------------------------------------------------
 // Implementation
 
@@ -2,7 +2,9 @@
 #include "PommeDebug.h"
 #include "PommeFiles.h"
 #include "Files/HostVolume.h"
+#include "Memory/PageAllocator.h"
 #include "Utilities/bigendianstreams.h"
+#include "Utilities/memstream.h"
 #include "Utilities/StringUtils.h"
 
 #include <fstream>
@@ -16,10 +18,12 @@ using namespace Pomme::Files;
 struct HostForkHandle : public ForkHandle
 {
 	std::fstream backingStream;
+	fs::path hostPath;
 
 public:
 	HostForkHandle(ForkType theForkType, char perm, fs::path& path, const FSSpec& theSpec)
 		: ForkHandle(theForkType, perm, theSpec)
+		, hostPath(path)
 	{
 		std::ios::openmode openmode = std::ios::binary;
 		if (permission & fsWrPerm) openmode |= std::ios::out;
@@ -34,8 +38,88 @@ public:
 	{
 		return backingStream;
 	}
+
+	virtual fs::path GetHostPath() const override
+	{
+		return hostPath;
+	}
 };
 
+#if POMME_MAPPED_FORKS
+// Read-only fork whose backing file is mapped into memory.
+// Reads through the stream come straight from the page cache, and GetMappedBytes gives zero-copy access.
+// The mapping is copy-on-write, so stray writes through the span never reach the file.
+struct MappedForkHandle : public ForkHandle
+{
+	struct Mapping
+	{
+		intptr_t file;
+		char* data;
+		size_t size;
+
+		explicit Mapping(const fs::path& path)
+			: data(nullptr)
+		{
+			file = Memory::PageAllocator::OpenMappableFile(path, size);
+			if (file != -1)
+				data = Memory::PageAllocator::MapFileView(file, 0, size);
+		}
+
+		~Mapping()
+		{
+			if (data)
+				Memory::PageAllocator::UnmapFileView(data, size);
+			if (file != -1)
+				Memory::PageAllocator::CloseMappableFile(file);
+		}
+	};
+
+	Mapping mapping;		// must be initialized before the stream
+	memstream stream;
+	fs::path hostPath;
+
+public:
+	MappedForkHandle(ForkType theForkType, char perm, const fs::path& path, const FSSpec& theSpec)
+		: ForkHandle(theForkType, perm, theSpec)
+		, mapping(path)
+		, stream(mapping.data, mapping.size)
+		, hostPath(path)
+	{
+	}
+
+	virtual ~MappedForkHandle() = default;
+
+	bool IsMapped() const
+	{
+		return mapping.data != nullptr;
+	}
+
+	virtual std::iostream& GetStream() override
+	{
+		return stream;
+	}
+
+	virtual std::span<char> GetMappedBytes() override
+	{
+		return std::span<char>(mapping.data, mapping.size);
+	}
+
+	virtual char* MapView(std::streamoff offset, size_t size) override
+	{
+		// Touching pages past the end of the file would fault
+		if (offset < 0 || size == 0 || uint64_t(offset) > mapping.size || size > mapping.size - size_t(offset))
+			return nullptr;
+
+		return Memory::PageAllocator::MapFileView(mapping.file, uint64_t(offset), size);
+	}
+
+	virtual fs::path GetHostPath() const override
+	{
+		return hostPath;
+	}
+};
+#endif
+
 
 HostVolume::HostVolume(short vRefNum)
 	: Volume(vRefNum)
@@ -135,23 +219,36 @@ OSErr HostVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permissio
 
 	auto path = ToPath(spec->parID, spec->cName);
 
-	if (forkType == DataFork)
-	{
-		if (!fs::is_regular_file(path))
-		{
-			return fnfErr;
-		}
-		handle = std::make_unique<HostForkHandle>(DataFork, permission, path, *spec);
-	}
-	else
+	if (forkType == ResourceFork)
 	{
 		// We want to open a resource fork on the host volume. It is likely stored as <NAME>.rsrc.
 		path += ".rsrc";
-		if (!fs::is_regular_file(path))
+	}
+
+	if (!fs::is_regular_file(path))
+	{
+		return fnfErr;
+	}
+
+#if POMME_MAPPED_FORKS
+	// Map read-only forks if possible; fall back to an fstream otherwise (e.g. for empty files)
+	if (!(permission & fsWrPerm))
+	{
+		auto mappedHandle = std::make_unique<MappedForkHandle>(forkType, permission, path, *spec);
+		if (mappedHandle->IsMapped())
 		{
-			return fnfErr;
+			handle = std::move(mappedHandle);
 		}
-		handle = std::make_unique<HostForkHandle>(ResourceFork, permission, path, *spec);
+	}
+#endif
+
+	if (!handle)
+	{
+		handle = std::make_unique<HostForkHandle>(forkType, permission, path, *spec);
+	}
+
+	if (forkType == ResourceFork)
+	{
 		if (!handle->GetStream().good())
 		{
 			return ioErr;
@@ -167,7 +264,88 @@ OSErr HostVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permissio
 	return noErr;
 }
 
-static bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles = false)
+//-----------------------------------------------------------------------------
+// Directory listings
+
+static u8string GetListingKey(const fs::path& dirPath)
+{
+	auto path = dirPath.lexically_normal();
+	if (!path.has_filename())	// trailing separator
+		path = path.parent_path();
+	return path.u8string();
+}
+
+const HostVolume::DirectoryListing* HostVolume::GetDirectoryListing(const fs::path& dirPath)
+{
+	std::error_code ec;
+	auto lastWriteTime = fs::last_write_time(dirPath, ec);
+	if (ec)
+	{
+		return nullptr;
+	}
+
+	auto key = GetListingKey(dirPath);
+
+	auto it = listings.find(key);
+	if (it != listings.end() && it->second.lastWriteTime == lastWriteTime)
+	{
+		return &it->second;
+	}
+
+	DirectoryListing listing;
+	listing.lastWriteTime = lastWriteTime;
+
+	// Iterate with error codes, since a range-for would throw if advancing the iterator failed
+	for (fs::directory_iterator entry(dirPath, ec), end; !ec && entry != end; entry.increment(ec))
+	{
+		const auto& candidate = *entry;
+
+		// Skip entries we can't stat (e.g. unreadable ones) rather than spoil the whole listing
+		std::error_code entryError;
+		bool isDirectory = candidate.is_directory(entryError);
+		if (entryError)
+		{
+			continue;
+		}
+
+		fs::path candidateFilename = candidate.path().filename();
+
+		// It might be an AppleDouble resource fork ("file.rsrc")
+		if (!isDirectory && candidateFilename.extension() == ".rsrc" && candidate.is_regular_file(entryError))
+		{
+			candidateFilename.replace_extension("");
+		}
+
+		// Uppercase filenames for case-insensitive comparisons.
+		// If several entries collide, the first one seen wins.
+		auto name = candidateFilename.u8string();
+		auto uppercaseName = UppercaseCopy(name);
+
+		if (isDirectory)
+		{
+			listing.subdirectoryNames.emplace(uppercaseName, name);
+		}
+		listing.names.emplace(std::move(uppercaseName), std::move(name));
+	}
+
+	if (ec)
+	{
+		return nullptr;
+	}
+
+	LOG << "listed " << dirPath << ": " << listing.names.size() << " entries\n";
+
+	auto& cached = listings[key];
+	cached = std::move(listing);
+	return &cached;
+}
+
+void HostVolume::InvalidateDirectoryListing(const fs::path& dirPath)
+{
+	listings.erase(GetListingKey(dirPath));
+}
+
+bool HostVolume::CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles)
 {
 	fs::path naiveConcat = path / element;
 
@@ -195,30 +373,14 @@ static bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element,
 		}
 	}
 #else
-	// Convert path element to uppercase for case-insensitive comparisons
-	const auto uppercaseElement = UppercaseCopy(element);
-
-	for (const auto& candidate : fs::directory_iterator(path))
+	if (const auto* listing = GetDirectoryListing(path))
 	{
-		if (skipFiles && !candidate.is_directory())
-		{
-			continue;
-		}
-
-		fs::path candidateFilename = candidate.path().filename();
-
-		// It might be an AppleDouble resource fork ("file.rsrc")
-		if (candidate.is_regular_file() && candidateFilename.extension() == ".rsrc")
-		{
-			candidateFilename.replace_extension("");
-		}
-
-		// Convert candidate filename to uppercase for case-insensitive comparison
-		const u8string uppercaseCandidateFilename = UppercaseCopy(candidateFilename.u8string());
+		const auto& names = skipFiles ? listing->subdirectoryNames : listing->names;
 
-		if (uppercaseElement == uppercaseCandidateFilename)
+		auto it = names.find(UppercaseCopy(element));
+		if (it != names.end())
 		{
-			path /= candidateFilename;
+			path /= it->second;
 			return true;
 		}
 	}
@@ -304,6 +466,8 @@ OSErr HostVolume::DirCreate(long parentDirID, const u8string& directoryName, lon
 		return ioErr;
 	}
 
+	InvalidateDirectoryListing(path.parent_path());
+
 	if (createdDirID)
 	{
 		*createdDirID = GetDirectoryID(path);
@@ -319,8 +483,11 @@ OSErr HostVolume::FSpCreate(const FSSpec* spec, OSType creator, OSType fileType,
 	(void) fileType;
 	(void) scriptTag;
 
-	std::ofstream df(ToPath(spec->parID, spec->cName));
+	auto path = ToPath(spec->parID, spec->cName);
+
+	std::ofstream df(path);
 	df.close();
+	InvalidateDirectoryListing(path.parent_path());
 	// TODO: we could write an AppleDouble file to save the creator/filetype.
 	return noErr;
 }
@@ -329,8 +496,9 @@ OSErr HostVolume::FSpDelete(const FSSpec* spec)
 {
 	auto path = ToPath(spec->parID, spec->cName);
 
-	if (fs::remove(path))
-		return noErr;
-	else
+	if (!fs::remove(path))
 		return fnfErr;
+
+	InvalidateDirectoryListing(path.parent_path());
+	return noErr;
 }
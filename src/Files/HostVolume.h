@@ -3,6 +3,7 @@
 #include "Files/Volume.h"
 #include "CompilerSupport/filesystem.h"
 #include "Utilities/StringUtils.h"
+#include <unordered_map>
 #include <vector>
 
 namespace Pomme::Files
@@ -13,11 +14,26 @@ namespace Pomme::Files
 	 */
 	class HostVolume : public Volume
 	{
+		struct DirectoryListing
+		{
+			fs::file_time_type lastWriteTime;
+			std::unordered_map<u8string, u8string> names;			// uppercased name -> actual name (".rsrc" stripped)
+			std::unordered_map<u8string, u8string> subdirectoryNames;	// same, subdirectories only
+		};
+
 		std::vector<fs::path> directories;
 
+		// Cached host directory contents for case-insensitive lookups, keyed by normalized path.
+		// An entry is rebuilt when its directory's mtime changes, or when we modify the directory ourselves.
+		std::unordered_map<u8string, DirectoryListing> listings;
+
 		fs::path ToPath(long parID, const char* name);
 		fs::path ToPath(long parID, const u8string& name);
 
+		const DirectoryListing* GetDirectoryListing(const fs::path& dirPath);
+		void InvalidateDirectoryListing(const fs::path& dirPath);
+		bool CaseInsensitiveAppendToPath(fs::path& path, const u8string& element, bool skipFiles);
+
 	public:
 		explicit HostVolume(short vRefNum);
 
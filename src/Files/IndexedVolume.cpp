@@ -0,0 +1,197 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/IndexedVolume.h"
+
+#include <iostream>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "IVOL")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+IndexedVolume::IndexedVolume(short vRefNum)
+	: Volume(vRefNum)
+{
+	// root (ID 0) is its own parent
+	directories.push_back({ 0, u8string(), {} });
+}
+
+//-----------------------------------------------------------------------------
+// Tree construction
+
+void IndexedVolume::AddEntry(UInt32 parent, const u8string& name, const Entry& entry)
+{
+	if (parent >= directories.size())
+	{
+		throw std::invalid_argument("IndexedVolume: bad parent directory");
+	}
+
+	if (name.empty() || name.length() > 255 || name.find(':') != u8string::npos)
+	{
+		throw std::invalid_argument("IndexedVolume: illegal name");
+	}
+
+	if (!directories[parent].entries.emplace(UppercaseCopy(name), entry).second)
+	{
+		throw std::runtime_error("IndexedVolume: duplicate name");
+	}
+}
+
+UInt32 IndexedVolume::AddDirectory(UInt32 parent, const u8string& name)
+{
+	UInt32 index = UInt32(directories.size());
+	AddEntry(parent, name, { true, index, name });
+	directories.push_back({ parent, name, {} });
+	return index;
+}
+
+UInt32 IndexedVolume::GetOrAddDirectory(UInt32 parent, const u8string& name)
+{
+	if (const Entry* entry = FindEntry(parent, name))
+	{
+		if (!entry->isDirectory)
+			throw std::runtime_error("IndexedVolume: a file is in the way of a directory");
+		return entry->index;
+	}
+
+	return AddDirectory(parent, name);
+}
+
+void IndexedVolume::AddFile(UInt32 parent, const u8string& name, UInt32 fileIndex)
+{
+	AddEntry(parent, name, { false, fileIndex, name });
+}
+
+const IndexedVolume::Entry* IndexedVolume::FindEntry(long dirID, const u8string& name) const
+{
+	if (dirID < 0 || (unsigned long) dirID >= directories.size())
+		return nullptr;
+
+	const auto& entries = directories[dirID].entries;
+	auto it = entries.find(UppercaseCopy(name));
+	return it == entries.end() ? nullptr : &it->second;
+}
+
+//-----------------------------------------------------------------------------
+// Implementation
+
+OSErr IndexedVolume::FSMakeFSSpec(long dirID, const u8string& fileName, FSSpec* spec)
+{
+	if (dirID < 0 || (unsigned long) dirID >= directories.size())
+	{
+		throw std::runtime_error("IndexedVolume::FSMakeFSSpec: directory ID not registered.");
+	}
+
+	UInt32 directory = UInt32(dirID);
+	u8string leafName;
+	OSErr result = noErr;
+
+	u8string::size_type begin = (!fileName.empty() && fileName.at(0) == ':') ? 1 : 0;
+
+	// Iterate on path elements between colons
+	while (begin < fileName.length())
+	{
+		auto end = fileName.find(':', begin);
+
+		bool isLeaf = end == std::string::npos; // no ':' found => end of path
+		if (isLeaf) end = fileName.length();
+
+		if (end == begin) // "::" => parent directory
+		{
+			directory = directories[directory].parent;
+		}
+		else if (!isLeaf)
+		{
+			auto element = fileName.substr(begin, end - begin);
+			const Entry* entry = FindEntry(directory, element);
+			if (!entry || !entry->isDirectory)
+			{
+				// Can't go any further; leave the spec pointing at the missing directory
+				leafName = element;
+				result = dirNFErr;
+				break;
+			}
+			directory = entry->index;
+		}
+		else
+		{
+			leafName = fileName.substr(begin, end - begin);
+			if (const Entry* entry = FindEntry(directory, leafName))
+				leafName = entry->name;
+			else
+				result = fnfErr;
+		}
+
+		// +1: jump over current colon
+		begin = end + 1;
+	}
+
+	// A path that ends with a colon designates a directory
+	if (leafName.empty())
+	{
+		leafName = directories[directory].name;
+		directory = directories[directory].parent;
+	}
+
+	spec->vRefNum = volumeID;
+	spec->parID = directory;
+	snprintf(spec->cName, 256, "%s", (const char*) leafName.c_str());
+
+	LOG << (const char*) fileName.c_str() << " -> " << spec->parID << ":" << spec->cName << " (" << result << ")\n";
+
+	return result;
+}
+
+OSErr IndexedVolume::OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle)
+{
+	if (permission & fsWrPerm)
+	{
+		return vLckdErr;
+	}
+
+	if (spec->parID < 0 || (unsigned long) spec->parID >= directories.size())
+	{
+		return dirNFErr;
+	}
+
+	const Entry* entry = FindEntry(spec->parID, u8string((const char8_t*) spec->cName));
+	if (!entry || entry->isDirectory)
+	{
+		return fnfErr;
+	}
+
+	try
+	{
+		return OpenFileFork(entry->index, spec, forkType, permission, handle);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << __func__ << ": " << spec->cName << ": " << e.what() << "\n";
+		handle.reset();
+		return ioErr;
+	}
+}
+
+OSErr IndexedVolume::FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag)
+{
+	(void) spec;
+	(void) creator;
+	(void) fileType;
+	(void) scriptTag;
+	return vLckdErr;
+}
+
+OSErr IndexedVolume::FSpDelete(const FSSpec* spec)
+{
+	(void) spec;
+	return vLckdErr;
+}
+
+OSErr IndexedVolume::DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID)
+{
+	(void) parentDirID;
+	(void) directoryName;
+	(void) createdDirID;
+	return vLckdErr;
+}
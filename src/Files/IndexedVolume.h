@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Files/Volume.h"
+#include "Utilities/StringUtils.h"
+#include <unordered_map>
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Base class for read-only volumes whose directory tree is kept in memory.
+	 * Path lookups are case-insensitive. Directory IDs are indices into the tree; the root is 0.
+	 * Subclasses register their files with AddFile, and open their forks in OpenFileFork.
+	 */
+	class IndexedVolume : public Volume
+	{
+		struct Entry
+		{
+			bool isDirectory;
+			UInt32 index;		// into `directories`, or a file index defined by the subclass
+			u8string name;
+		};
+
+		struct Directory
+		{
+			UInt32 parent;
+			u8string name;
+			std::unordered_map<u8string, Entry> entries;	// keyed by uppercased name
+		};
+
+		std::vector<Directory> directories;
+
+		void AddEntry(UInt32 parent, const u8string& name, const Entry& entry);
+
+		const Entry* FindEntry(long dirID, const u8string& name) const;
+
+	protected:
+		explicit IndexedVolume(short vRefNum);
+
+		UInt32 GetNumDirectories() const
+		{
+			return UInt32(directories.size());
+		}
+
+		// The functions below throw std::invalid_argument if the parent or the name is illegal.
+
+		// Creates a subdirectory and returns its ID. Throws std::runtime_error if the name is taken.
+		UInt32 AddDirectory(UInt32 parent, const u8string& name);
+
+		// Returns the ID of the subdirectory, creating it if needed.
+		// Throws std::runtime_error if a file by that name is in the way.
+		UInt32 GetOrAddDirectory(UInt32 parent, const u8string& name);
+
+		// Throws std::runtime_error if the name is taken.
+		void AddFile(UInt32 parent, const u8string& name, UInt32 fileIndex);
+
+		virtual OSErr OpenFileFork(UInt32 fileIndex, const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) = 0;
+
+	public:
+		virtual ~IndexedVolume() = default;
+
+		//-----------------------------------------------------------------------------
+		// Toolbox API Implementation
+
+		OSErr FSMakeFSSpec(long dirID, const u8string& fileName, FSSpec* spec) override;
+
+		OSErr OpenFork(const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) override;
+
+		OSErr FSpCreate(const FSSpec* spec, OSType creator, OSType fileType, ScriptCode scriptTag) override;
+
+		OSErr FSpDelete(const FSSpec* spec) override;
+
+		OSErr DirCreate(long parentDirID, const u8string& directoryName, long* createdDirID) override;
+	};
+}
@@ -0,0 +1,86 @@
+#include "PommeEnums.h"
+#include "PommeDebug.h"
+#include "PommeFiles.h"
+#include "Files/MemoryVolume.h"
+#include "Utilities/memstream.h"
+
+#define LOG POMME_GENLOG(POMME_DEBUG_FILES, "MVOL")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+//-----------------------------------------------------------------------------
+// Fork handle
+
+// Read-only fork living in a caller-supplied buffer.
+struct MemoryForkHandle : public ForkHandle
+{
+	std::span<char> bytes;
+	memstream stream;
+
+public:
+	// The volume is read-only, so the buffer is never written through the non-const span and stream.
+	MemoryForkHandle(ForkType theForkType, char perm, const FSSpec& theSpec, std::span<const char> theBytes)
+		: ForkHandle(theForkType, perm, theSpec)
+		, bytes(const_cast<char*>(theBytes.data()), theBytes.size())
+		, stream(bytes.data(), bytes.size())
+	{
+	}
+
+	virtual ~MemoryForkHandle() = default;
+
+	virtual std::iostream& GetStream() override
+	{
+		return stream;
+	}
+
+	virtual std::span<char> GetMappedBytes() override
+	{
+		return bytes;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Memory volume
+
+MemoryVolume::MemoryVolume(short vRefNum)
+	: IndexedVolume(vRefNum)
+{
+}
+
+void MemoryVolume::AddFile(const u8string& path, const char* dataFork, size_t dataForkSize, const char* resourceFork, size_t resourceForkSize)
+{
+	UInt32 directory = 0;
+	u8string::size_type begin = (!path.empty() && path.at(0) == ':') ? 1 : 0;
+	u8string::size_type end;
+
+	// Every element but the last one is a directory
+	while ((end = path.find(':', begin)) != u8string::npos)
+	{
+		directory = GetOrAddDirectory(directory, path.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	IndexedVolume::AddFile(directory, path.substr(begin), UInt32(files.size()));
+
+	File file;
+	file.present[DataFork] = dataFork != nullptr;
+	file.present[ResourceFork] = resourceFork != nullptr;
+	file.forks[DataFork] = dataFork ? std::span<const char>(dataFork, dataForkSize) : std::span<const char>();
+	file.forks[ResourceFork] = resourceFork ? std::span<const char>(resourceFork, resourceForkSize) : std::span<const char>();
+	files.push_back(file);
+
+	LOG << (const char*) path.c_str() << ": " << dataForkSize << " + " << resourceForkSize << " bytes\n";
+}
+
+OSErr MemoryVolume::OpenFileFork(UInt32 fileIndex, const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle)
+{
+	const File& file = files.at(fileIndex);
+	if (!file.present[forkType])
+	{
+		return fnfErr;
+	}
+
+	handle = std::make_unique<MemoryForkHandle>(forkType, permission, *spec, file.forks[forkType]);
+	return noErr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Files/IndexedVolume.h"
+#include <span>
+#include <vector>
+
+namespace Pomme::Files
+{
+	/**
+	 * Read-only volume that serves files out of caller-supplied memory buffers,
+	 * e.g. assets linked into the executable or generated at runtime.
+	 * The buffers are neither copied nor modified, and must outlive the volume.
+	 * Resource forks are raw resource fork bytes, without an AppleDouble wrapper.
+	 */
+	class MemoryVolume : public IndexedVolume
+	{
+		struct File
+		{
+			bool present[2];				// indexed by ForkType
+			std::span<const char> forks[2];	// indexed by ForkType
+		};
+
+		std::vector<File> files;
+
+	protected:
+		OSErr OpenFileFork(UInt32 fileIndex, const FSSpec* spec, ForkType forkType, char permission, std::unique_ptr<ForkHandle>& handle) override;
+
+	public:
+		explicit MemoryVolume(short vRefNum);
+
+		virtual ~MemoryVolume() = default;
+
+		// Adds a file at a colon-separated path relative to the root (e.g. "Data:Models:Level1.3dmf"),
+		// creating intermediate directories as needed. Pass a null pointer to leave a fork out.
+		// Throws std::invalid_argument if the path is illegal, or std::runtime_error if it's already taken.
+		void AddFile(const u8string& path, const char* dataFork, size_t dataForkSize, const char* resourceFork, size_t resourceForkSize);
+	};
+}
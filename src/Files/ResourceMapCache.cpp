@@ -0,0 +1,212 @@
+#include "Files/ResourceMapCache.h"
+#include "PommeDebug.h"
+#include "Utilities/bigendianstreams.h"
+
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+#define LOG POMME_GENLOG(POMME_DEBUG_RESOURCES, "RMAP")
+
+using namespace Pomme;
+using namespace Pomme::Files;
+
+static constexpr UInt32 kMagic = 'RMAP';
+
+// Bump this whenever the layout below changes
+static constexpr UInt16 kVersion = 1;
+
+static std::mutex gCacheDirectoryMutex;
+static fs::path gCacheDirectory;
+
+struct FileStamp
+{
+	UInt64 size;
+	SInt64 modTime;
+};
+
+static bool GetFileStamp(const fs::path& path, FileStamp& stamp)
+{
+	std::error_code ec;
+
+	stamp.size = fs::file_size(path, ec);
+	if (ec)
+		return false;
+
+	stamp.modTime = fs::last_write_time(path, ec).time_since_epoch().count();
+	if (ec)
+		return false;
+
+	return true;
+}
+
+static fs::path GetCacheDirectory()
+{
+	std::lock_guard<std::mutex> lock(gCacheDirectoryMutex);
+	return gCacheDirectory;
+}
+
+// Cache files are named after a hash of the resource file's path (FNV-1a).
+// The full path is stored in the cache file as well, to rule out collisions.
+static fs::path GetCachePath(const fs::path& cacheDirectory, const std::string& forkPathString)
+{
+	UInt64 hash = 0xCBF29CE484222325ull;
+	for (char c : forkPathString)
+	{
+		hash ^= Byte(c);
+		hash *= 0x100000001B3ull;
+	}
+
+	std::stringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << hash << ".rmap";
+	return cacheDirectory / name.str();
+}
+
+void ResourceMapCache::SetDirectory(const fs::path& directory)
+{
+	std::lock_guard<std::mutex> lock(gCacheDirectoryMutex);
+	gCacheDirectory = directory;
+}
+
+bool ResourceMapCache::IsEnabled()
+{
+	std::lock_guard<std::mutex> lock(gCacheDirectoryMutex);
+	return !gCacheDirectory.empty();
+}
+
+bool ResourceMapCache::Load(const fs::path& forkPath, ResourceFork& fork)
+{
+	fs::path cacheDirectory = GetCacheDirectory();
+	if (cacheDirectory.empty() || forkPath.empty())
+		return false;
+
+	FileStamp stamp;
+	if (!GetFileStamp(forkPath, stamp))
+		return false;
+
+	std::string forkPathString = forkPath.string();
+	std::ifstream file(GetCachePath(cacheDirectory, forkPathString), std::ios::binary);
+	if (!file)
+		return false;
+
+	try
+	{
+		auto f = BigEndianIStream(file);
+
+		if (f.Read<UInt32>() != kMagic || f.Read<UInt16>() != kVersion)
+			return false;
+
+		std::string cachedPath(f.Read<UInt16>(), '\0');
+		f.Read(cachedPath.data(), cachedPath.size());
+
+		if (cachedPath != forkPathString
+			|| f.Read<UInt64>() != stamp.size
+			|| f.Read<SInt64>() != stamp.modTime)
+		{
+			LOG << "stale map for " << forkPath << "\n";
+			return false;
+		}
+
+		UInt32 nResources = f.Read<UInt32>();
+
+		std::vector<ResourceMetadata> resources;
+		resources.reserve(std::min<UInt32>(nResources, 4096));
+
+		for (UInt32 i = 0; i < nResources; i++)
+		{
+			ResourceMetadata meta;
+			meta.forkRefNum	= fork.fileRefNum;
+			meta.type		= f.Read<OSType>();
+			meta.id			= f.Read<SInt16>();
+			meta.flags		= f.Read<Byte>();
+			meta.dataOffset	= f.Read<UInt32>();
+			meta.size		= f.Read<SInt32>();
+			meta.name		= f.ReadPascalString();
+
+			// Don't trust a damaged cache file to point within the resource file
+			if (meta.size < 0 || meta.dataOffset < 4 || UInt64(meta.dataOffset) + UInt64(meta.size) > stamp.size)
+				return false;
+
+			resources.push_back(std::move(meta));
+		}
+
+		fork.resources = std::move(resources);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+
+	LOG << "loaded map for " << forkPath << "\n";
+	return true;
+}
+
+void ResourceMapCache::Save(const fs::path& forkPath, const ResourceFork& fork)
+{
+	fs::path cacheDirectory = GetCacheDirectory();
+	if (cacheDirectory.empty() || forkPath.empty())
+		return;
+
+	FileStamp stamp;
+	if (!GetFileStamp(forkPath, stamp))
+		return;
+
+	std::string forkPathString = forkPath.string();
+	if (forkPathString.size() > 0xFFFF)
+		return;
+
+	std::error_code ec;
+	fs::create_directories(cacheDirectory, ec);
+
+	fs::path cachePath = GetCachePath(cacheDirectory, forkPathString);
+
+	// Write to a temporary file, then move it into place, so that readers never see a half-written map
+	fs::path tempPath = cachePath;
+	tempPath += ".tmp";
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			LOG << "can't write " << tempPath << "\n";
+			return;
+		}
+
+		auto f = BigEndianOStream(file);
+
+		f.Write<UInt32>(kMagic);
+		f.Write<UInt16>(kVersion);
+		f.Write<UInt16>(UInt16(forkPathString.size()));
+		f.WriteRawString(forkPathString);
+		f.Write<UInt64>(stamp.size);
+		f.Write<SInt64>(stamp.modTime);
+		f.Write<UInt32>(UInt32(fork.resources.size()));
+
+		for (const auto& meta : fork.resources)
+		{
+			f.Write<OSType>(meta.type);
+			f.Write<SInt16>(meta.id);
+			f.Write<Byte>(meta.flags);
+			f.Write<UInt32>(UInt32(meta.dataOffset));
+			f.Write<SInt32>(meta.size);
+			f.WritePascalString(meta.name);
+		}
+
+		if (!file)
+		{
+			file.close();
+			fs::remove(tempPath, ec);
+			return;
+		}
+	}
+
+	fs::rename(tempPath, cachePath, ec);
+	if (ec)
+	{
+		fs::remove(tempPath, ec);
+		return;
+	}
+
+	LOG << "saved map for " << forkPath << " to " << cachePath << "\n";
+}
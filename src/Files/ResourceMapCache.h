@@ -0,0 +1,21 @@
+#pragma once
+
+#include "PommeFiles.h"
+#include "CompilerSupport/filesystem.h"
+
+namespace Pomme::Files::ResourceMapCache
+{
+	// Sets the directory where parsed resource maps are cached. An empty path disables the cache (the default).
+	void SetDirectory(const fs::path& directory);
+
+	// Returns true if a cache directory is set.
+	bool IsEnabled();
+
+	// Fills in the fork's resources from the cached map of the resource file at `forkPath`.
+	// Returns false if there's no cached map, or if the file's size or modification time have changed since it was cached.
+	bool Load(const fs::path& forkPath, ResourceFork& fork);
+
+	// Caches the fork's resources, whose sizes must all be known.
+	// Failures are silently ignored: the map will just be parsed again next time.
+	void Save(const fs::path& forkPath, const ResourceFork& fork);
+}
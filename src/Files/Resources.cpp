@@ -1,12 +1,22 @@
 #include "Pomme.h"
 #include "PommeFiles.h"
 #include "PommeMemory.h"
+#include "Files/ResourceMapCache.h"
 #include "Utilities/bigendianstreams.h"
+#include "Utilities/memstream.h"
+#include "Utilities/ScratchArena.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "CompilerSupport/filesystem.h"
 
 #if _DEBUG
@@ -23,10 +33,17 @@ using namespace Pomme::Files;
 
 static OSErr gLastResError = noErr;
 
-static std::vector<ResourceFork> gResForkStack;
+// See Pomme_SetPurgeableResources
+static std::atomic<bool> gPurgeableResources = false;
+
+// Forks are heap-allocated so that their metadata never moves as the stack changes
+static std::vector<std::unique_ptr<ResourceFork>> gResForkStack;
 
 static int gResForkStackIndex = 0;
 
+// Maps (type, ID) to every open resource with that type and ID, from bottom to top of the fork stack
+static std::unordered_map<UInt64, std::vector<const ResourceMetadata*>> gResourceIndex;
+
 //-----------------------------------------------------------------------------
 // Internal
 
@@ -40,111 +57,494 @@ static void ResourceAssert(bool condition, const char* message)
 
 static ResourceFork& GetCurRF()
 {
-	return gResForkStack[gResForkStackIndex];
+	return *gResForkStack[gResForkStackIndex];
+}
+
+static UInt64 GetResourceKey(ResType type, SInt16 id)
+{
+	return (UInt64(type) << 16) | UInt16(id);
+}
+
+static const ResourceFork::TypeRange* FindType(const ResourceFork& fork, ResType type)
+{
+	auto it = std::lower_bound(fork.types.begin(), fork.types.end(), type,
+		[](const ResourceFork::TypeRange& range, ResType t) { return range.type < t; });
+
+	if (it == fork.types.end() || it->type != type)
+		return nullptr;
+
+	return &*it;
+}
+
+// Returns true if GetResource may look for resources in this fork, i.e. if the fork
+// is at or below the current resource file in the stack.
+static bool IsForkInSearchPath(short refNum)
+{
+	if (gResForkStackIndex == int(gResForkStack.size()) - 1)
+		return true;
+
+	for (int i = 0; i <= gResForkStackIndex; i++)
+	{
+		if (gResForkStack[i]->fileRefNum == refNum)
+			return true;
+	}
+
+	return false;
+}
+
+// Returns the topmost resource with the given type and ID among the forks in the search path.
+static const ResourceMetadata* FindResource(ResType type, SInt16 id)
+{
+	auto candidates = gResourceIndex.find(GetResourceKey(type, id));
+
+	if (candidates != gResourceIndex.end())
+	{
+		for (auto it = candidates->second.rbegin(); it != candidates->second.rend(); ++it)
+		{
+			if (IsForkInSearchPath((*it)->forkRefNum))
+				return *it;
+		}
+	}
+
+	return nullptr;
+}
+
+// Sorts the resources of a freshly-parsed fork, builds its type ranges, and adds it to the index.
+static void IndexResourceFork(ResourceFork& fork)
+{
+	auto& resources = fork.resources;
+
+	std::stable_sort(resources.begin(), resources.end(),
+		[](const ResourceMetadata& a, const ResourceMetadata& b) { return a.type != b.type ? a.type < b.type : a.id < b.id; });
+
+	// If a type/ID pair appears more than once, the last occurrence in the map wins
+	auto last = std::unique(resources.rbegin(), resources.rend(),
+		[](const ResourceMetadata& a, const ResourceMetadata& b) { return a.type == b.type && a.id == b.id; });
+	resources.erase(resources.begin(), last.base());
+
+	for (UInt32 i = 0; i < resources.size(); i++)
+	{
+		if (fork.types.empty() || fork.types.back().type != resources[i].type)
+			fork.types.push_back({ resources[i].type, i, 0 });
+		fork.types.back().count++;
+
+		gResourceIndex[GetResourceKey(resources[i].type, resources[i].id)].push_back(&resources[i]);
+	}
+}
+
+static void UnindexResourceFork(const ResourceFork& fork)
+{
+	for (const auto& meta : fork.resources)
+	{
+		auto it = gResourceIndex.find(GetResourceKey(meta.type, meta.id));
+		auto& candidates = it->second;
+		candidates.erase(std::find(candidates.begin(), candidates.end(), &meta));
+		if (candidates.empty())
+			gResourceIndex.erase(it);
+	}
+}
+
+// Returns the open fork that a resource belongs to. Main thread only.
+static ResourceFork& GetFork(const ResourceMetadata& meta)
+{
+	for (auto& fork : gResForkStack)
+	{
+		if (fork->fileRefNum == meta.forkRefNum)
+			return *fork;
+	}
+
+	throw std::runtime_error("GetFork: Resource fork not open");
+}
+
+// Resource sizes are stored next to the data rather than in the map,
+// so they're looked up when the resource is first accessed.
+// The caller must hold the fork's streamMutex.
+static SInt32 GetResourceSize(const ResourceFork& fork, const ResourceMetadata& meta)
+{
+	if (meta.size < 0)
+	{
+		std::streamoff sizeOff = meta.dataOffset - 4;
+
+		if (sizeOff + 4 <= std::streamoff(fork.mappedBytes.size()))
+		{
+			const auto* p = reinterpret_cast<const Byte*>(fork.mappedBytes.data() + sizeOff);
+			meta.size = SInt32(UInt32(p[0]) << 24 | UInt32(p[1]) << 16 | UInt32(p[2]) << 8 | UInt32(p[3]));
+		}
+		else
+		{
+			auto f = Pomme::BigEndianIStream(*fork.stream);
+			f.Goto(sizeOff);
+			meta.size = f.Read<SInt32>();
+		}
+
+		ResourceAssert(meta.size >= 0, "GetResourceSize: Corrupt resource size");
+	}
+
+	return meta.size;
+}
+
+// The caller must hold the fork's streamMutex.
+static void ReadResourceData(const ResourceFork& fork, Handle handle, const ResourceMetadata& meta)
+{
+	fork.stream->seekg(meta.dataOffset, std::ios::beg);
+	fork.stream->read(*handle, GetResourceSize(fork, meta));
+}
+
+// Smaller resources are cheaper to copy than to map
+static constexpr SInt32 kMinMappedResourceSize = 64 * 1024;
+
+// Pomme_GetResources reads through gaps up to this size between resources rather than seeking past them
+static constexpr std::streamoff kMaxCoalescedGap = 16 * 1024;
+
+// Pomme_GetResources stages coalesced reads in scratch memory; these keep the staging area in check.
+// Larger resources are read straight into their handles: the cost of seeking to them is small in comparison.
+static constexpr SInt32 kMaxCoalescedResourceSize = 64 * 1024;
+static constexpr std::streamoff kMaxCoalescedRunSize = 1024 * 1024;
+
+// Returns a private copy-on-write view of a large resource's data if its fork is memory-mapped,
+// or nullptr if the resource must be read in the usual way.
+// The caller must hold the fork's streamMutex.
+static Ptr MapResourceData(const ResourceFork& fork, const ResourceMetadata& meta)
+{
+#if POMME_MAPPED_RESOURCES
+	if (GetResourceSize(fork, meta) >= kMinMappedResourceSize)
+		return Pomme::Files::MapForkView(meta.forkRefNum, meta.dataOffset, meta.size);
+#else
+	(void) fork;
+	(void) meta;
+#endif
+	return nullptr;
 }
 
 //-----------------------------------------------------------------------------
-// Resource file management
+// Prefetching
+//
+// A worker thread reads requested resources into handles ahead of time.
+// The prefetched handles are held in a cache until GetResource claims them.
 
-OSErr ResError(void)
+// Unclaimed prefetched resources can simply be read again, but they were asked for
+// because they're about to be needed, so give them up after purgeable handles.
+static constexpr int kPrefetchEvictionPriority = 1;
+
+struct PrefetchRequest
 {
-	return gLastResError;
+	ResourceFork* fork;
+	const ResourceMetadata* meta;
+};
+
+static std::mutex gPrefetchMutex;
+static std::condition_variable gPrefetchCondition;
+static std::deque<PrefetchRequest> gPrefetchQueue;
+static std::unordered_map<const ResourceMetadata*, Handle> gPrefetchedResources;
+static const ResourceFork* gPrefetchForkInFlight = nullptr;		// fork being read by the worker
+static const ResourceMetadata* gPrefetchMetaInFlight = nullptr;	// resource being read by the worker
+static bool gPrefetchQuit = false;
+
+static void PrefetchThreadProc()
+{
+	std::unique_lock<std::mutex> lock(gPrefetchMutex);
+
+	while (true)
+	{
+		gPrefetchCondition.wait(lock, []() { return gPrefetchQuit || !gPrefetchQueue.empty(); });
+
+		if (gPrefetchQuit)
+			return;
+
+		PrefetchRequest request = gPrefetchQueue.front();
+		gPrefetchQueue.pop_front();
+
+		if (gPrefetchedResources.contains(request.meta))
+			continue;
+
+		// CloseResFile waits for us to be done with the fork before destroying it
+		gPrefetchForkInFlight = request.fork;
+		gPrefetchMetaInFlight = request.meta;
+		lock.unlock();
+
+		Handle handle = nullptr;
+		try
+		{
+			std::lock_guard<std::mutex> forkLock(request.fork->streamMutex);
+			POMME_ALLOC_TAG("prefetched resource");
+			handle = NewHandle(GetResourceSize(*request.fork, *request.meta));
+			ReadResourceData(*request.fork, handle, *request.meta);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Couldn't prefetch resource " << FourCCString(request.meta->type) << " #" << request.meta->id << ": " << e.what() << "\n";
+			if (handle)
+			{
+				DisposeHandle(handle);
+				handle = nullptr;
+			}
+		}
+
+		lock.lock();
+		gPrefetchForkInFlight = nullptr;
+		gPrefetchMetaInFlight = nullptr;
+
+		if (handle)
+			gPrefetchedResources[request.meta] = handle;
+
+		gPrefetchCondition.notify_all();
+	}
 }
 
-short FSpOpenResFile(const FSSpec* spec, char permission)
+static void EvictPrefetchedResources(Size bytesNeeded, void*)
 {
-	short slot;
+	std::vector<Handle> evicted;
+	Size freed = 0;
 
-	gLastResError = FSpOpenRF(spec, permission, &slot);
+	{
+		std::lock_guard<std::mutex> lock(gPrefetchMutex);
 
-	if (noErr != gLastResError)
+		auto it = gPrefetchedResources.begin();
+		while (it != gPrefetchedResources.end() && freed < bytesNeeded)
+		{
+			freed += GetHandleSize(it->second);
+			evicted.push_back(it->second);
+			it = gPrefetchedResources.erase(it);
+		}
+	}
+
+	for (Handle handle : evicted)
+		DisposeHandle(handle);
+}
+
+// Owns the worker thread, and joins it on exit.
+// Declared after the rest of the prefetch state, so that it's destroyed first.
+class PrefetchThread
+{
+	std::thread thread;
+
+public:
+	// Must be called with gPrefetchMutex held.
+	void Start()
 	{
-		return -1;
+		if (!thread.joinable())
+		{
+			Pomme_RegisterEvictionCallback(EvictPrefetchedResources, nullptr, kPrefetchEvictionPriority);
+			thread = std::thread(PrefetchThreadProc);
+		}
 	}
 
-	auto f = Pomme::BigEndianIStream(Pomme::Files::GetStream(slot));
-	std::streamoff resForkOff = f.Tell();
+	~PrefetchThread()
+	{
+		if (thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(gPrefetchMutex);
+				gPrefetchQuit = true;
+			}
+			gPrefetchCondition.notify_all();
+			thread.join();
+		}
+	}
+};
 
-	// ----------------
-	// Load resource fork
+static PrefetchThread gPrefetchThread;
 
-	gResForkStack.emplace_back();
-	gResForkStackIndex = int(gResForkStack.size() - 1);
-	GetCurRF().fileRefNum = slot;
-	GetCurRF().resourceMap.clear();
+// Returns the prefetched data for a resource, or nullptr if it hasn't been prefetched.
+// The caller takes ownership of the handle. Since the caller is about to read the resource itself,
+// a pending prefetch for it is dropped; if the worker is reading it right now, we wait for it.
+static Handle TakePrefetchedResource(const ResourceMetadata& meta)
+{
+	std::unique_lock<std::mutex> lock(gPrefetchMutex);
+
+	std::erase_if(gPrefetchQueue, [&](const PrefetchRequest& request) { return request.meta == &meta; });
+
+	gPrefetchCondition.wait(lock, [&]() { return gPrefetchMetaInFlight != &meta; });
+
+	auto it = gPrefetchedResources.find(&meta);
+	if (it == gPrefetchedResources.end())
+		return nullptr;
+
+	Handle handle = it->second;
+	gPrefetchedResources.erase(it);
+	return handle;
+}
+
+// Drops pending and finished prefetches for a fork that's about to be closed.
+static void CancelPrefetches(const ResourceFork& fork)
+{
+	std::vector<Handle> discarded;
+
+	{
+		std::unique_lock<std::mutex> lock(gPrefetchMutex);
+
+		std::erase_if(gPrefetchQueue, [&](const PrefetchRequest& request) { return request.fork == &fork; });
+
+		gPrefetchCondition.wait(lock, [&]() { return gPrefetchForkInFlight != &fork; });
+
+		for (auto it = gPrefetchedResources.begin(); it != gPrefetchedResources.end(); )
+		{
+			if (it->first->forkRefNum == fork.fileRefNum)
+			{
+				discarded.push_back(it->second);
+				it = gPrefetchedResources.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+
+	for (Handle handle : discarded)
+		DisposeHandle(handle);
+}
+
+// Ties a freshly-loaded handle to its resource.
+static void AttachResourceMetadata(Handle handle, const ResourceMetadata& meta)
+{
+	// Set pointer to resource metadata
+	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(handle);
+	blockDescriptor->SetRezMeta(&meta);
+
+	// The resource can be reloaded from its fork at any time, but only apps that call
+	// LoadResource before touching it can cope with PurgeMem evicting it
+	if ((meta.flags & resPurgeable) && gPurgeableResources.load(std::memory_order_relaxed))
+		blockDescriptor->SetPurgeable(true);
+}
+
+// Reads the resource map of a fork whose stream is at the start of the resource data.
+static void ParseResourceMap(ResourceFork& fork)
+{
+	auto f = Pomme::BigEndianIStream(*fork.stream);
+	std::streamoff resForkOff = f.Tell();
 
 	// -------------------
 	// Resource Header
 	std::streamoff dataSectionOff = f.Read<UInt32>() + resForkOff;
 	std::streamoff mapSectionOff = f.Read<UInt32>() + resForkOff;
 	f.Skip(4); // UInt32 dataSectionLen
-	f.Skip(4); // UInt32 mapSectionLen
-	f.Skip(112 + 128); // system- (112) and app- (128) reserved data
+	UInt32 mapSectionLen = f.Read<UInt32>();
+
+	// The header is followed by system- (112) and app- (128) reserved data
+	ResourceAssert(dataSectionOff == resForkOff + 16 + 112 + 128, "ParseResourceMap: Unexpected data offset");
 
-	ResourceAssert(f.Tell() == dataSectionOff, "FSpOpenResFile: Unexpected data offset");
+	// -------------------
+	// Get the entire map in memory, so we can parse it without seeking around the fork.
+	// If the fork is memory-mapped, the map is already there.
+	std::vector<char> mapBuffer;
+	std::span<char> mapBytes;
+
+	if (mapSectionOff + mapSectionLen <= std::streamoff(fork.mappedBytes.size()))
+	{
+		mapBytes = fork.mappedBytes.subspan(mapSectionOff, mapSectionLen);
+	}
+	else
+	{
+		f.Goto(mapSectionOff);
+		mapBuffer.resize(mapSectionLen);
+		f.Read(mapBuffer.data(), mapSectionLen);
+		mapBytes = mapBuffer;
+	}
 
-	f.Goto(mapSectionOff);
+	memstream mapStream(mapBytes.data(), mapBytes.size());
+	auto m = Pomme::BigEndianIStream(mapStream);
 
 	// map header
-	f.Skip(16 + 4 + 2); // junk
-	f.Skip(2); // UInt16 fileAttr
-	std::streamoff typeListOff = f.Read<UInt16>() + mapSectionOff;
-	std::streamoff resNameListOff = f.Read<UInt16>() + mapSectionOff;
+	m.Skip(16 + 4 + 2); // junk
+	m.Skip(2); // UInt16 fileAttr
+	std::streamoff typeListOff = m.Read<UInt16>();
+	std::streamoff resNameListOff = m.Read<UInt16>();
 
 	// all resource types
-	int nResTypes = 1 + f.Read<UInt16>();
+	int nResTypes = 1 + m.Read<UInt16>();
 	for (int i = 0; i < nResTypes; i++)
 	{
-		OSType resType = f.Read<OSType>();
-		int    resCount = f.Read<UInt16>() + 1;
-		std::streamoff resRefListOff = f.Read<UInt16>() + typeListOff;
+		OSType resType = m.Read<OSType>();
+		int    resCount = m.Read<UInt16>() + 1;
+		std::streamoff resRefListOff = m.Read<UInt16>() + typeListOff;
 
-		// The guard will rewind the file cursor to the pos in the next iteration
-		auto guard1 = f.GuardPos();
+		// The guard will rewind the map cursor to the pos in the next iteration
+		auto guard1 = m.GuardPos();
 
-		f.Goto(resRefListOff);
+		m.Goto(resRefListOff);
 
 		for (int j = 0; j < resCount; j++)
 		{
-			SInt16 resID = f.Read<UInt16>();
-			UInt16 resNameRelativeOff = f.Read<UInt16>();
-			UInt32 resPackedAttr = f.Read<UInt32>();
-			f.Skip(4); // junk
-
-			// The guard will rewind the file cursor to the pos in the next iteration
-			auto guard2 = f.GuardPos();
+			SInt16 resID = m.Read<UInt16>();
+			UInt16 resNameRelativeOff = m.Read<UInt16>();
+			UInt32 resPackedAttr = m.Read<UInt32>();
+			m.Skip(4); // junk
 
 			// unpack attributes
 			Byte   resFlags = (resPackedAttr & 0xFF000000) >> 24;
 			std::streamoff resDataOff = (resPackedAttr & 0x00FFFFFF) + dataSectionOff;
 
 			// Check compressed flag
-			ResourceAssert(!(resFlags & 1), "FSpOpenResFile: Compressed resources not supported yet");
+			ResourceAssert(!(resFlags & 1), "ParseResourceMap: Compressed resources not supported yet");
+
+			ResourceMetadata resMetadata;
+			resMetadata.forkRefNum = fork.fileRefNum;
+			resMetadata.type       = resType;
+			resMetadata.id         = resID;
+			resMetadata.flags      = resFlags;
+			resMetadata.dataOffset = resDataOff + 4;
+			resMetadata.size       = -1;	// see GetResourceSize
 
 			// Fetch name
-			std::string name;
 			if (resNameRelativeOff != 0xFFFF)
 			{
-				f.Goto(resNameListOff + resNameRelativeOff);
-				name = f.ReadPascalString();
+				auto guard2 = m.GuardPos();
+				m.Goto(resNameListOff + resNameRelativeOff);
+				resMetadata.name = m.ReadPascalString();
 			}
 
-			// Fetch size
-			f.Goto(resDataOff);
-			SInt32 size = f.Read<SInt32>();
+			fork.resources.push_back(std::move(resMetadata));
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Resource file management
 
-			ResourceMetadata resMetadata;
-			resMetadata.forkRefNum = slot;
-			resMetadata.type       = resType;
-			resMetadata.id         = resID;
-			resMetadata.flags      = resFlags;
-			resMetadata.dataOffset = resDataOff + 4;
-			resMetadata.size       = size;
-			resMetadata.name       = name;
-			GetCurRF().resourceMap[resType][resID] = resMetadata;
+OSErr ResError(void)
+{
+	return gLastResError;
+}
+
+short FSpOpenResFile(const FSSpec* spec, char permission)
+{
+	short slot;
+
+	gLastResError = FSpOpenRF(spec, permission, &slot);
+
+	if (noErr != gLastResError)
+	{
+		return -1;
+	}
+
+	// ----------------
+	// Load resource fork
+
+	gResForkStack.push_back(std::make_unique<ResourceFork>());
+	gResForkStackIndex = int(gResForkStack.size() - 1);
+	GetCurRF().fileRefNum = slot;
+	GetCurRF().stream = &Pomme::Files::GetStream(slot);
+	GetCurRF().mappedBytes = Pomme::Files::GetMappedBytes(slot);
+
+	// Skip parsing if we've got an up-to-date copy of the map
+	auto hostPath = Pomme::Files::GetHostPath(slot);
+	if (!ResourceMapCache::Load(hostPath, GetCurRF()))
+	{
+		ParseResourceMap(GetCurRF());
+
+		// The cache spares us from looking up sizes later, so it's worth looking them all up now
+		if (!hostPath.empty() && ResourceMapCache::IsEnabled())
+		{
+			for (const auto& meta : GetCurRF().resources)
+				GetResourceSize(GetCurRF(), meta);
+
+			ResourceMapCache::Save(hostPath, GetCurRF());
 		}
 	}
 
+	IndexResourceFork(GetCurRF());
+
 	//PrintStack(__func__);
 
 	return slot;
@@ -169,7 +569,7 @@ void UseResFile(short refNum)
 
 	for (size_t i = 0; i < gResForkStack.size(); i++)
 	{
-		if (gResForkStack[i].fileRefNum == refNum)
+		if (gResForkStack[i]->fileRefNum == refNum)
 		{
 			gLastResError = noErr;
 			gResForkStackIndex = (int) i;
@@ -192,16 +592,38 @@ void CloseResFile(short refNum)
 	ResourceAssert(refNum >= 0, "CloseResFile: Illegal refNum");
 	ResourceAssert(IsStreamOpen(refNum), "CloseResFile: Resource stream not open");
 
+	for (const auto& fork : gResForkStack)
+	{
+		if (fork->fileRefNum == refNum)
+			CancelPrefetches(*fork);
+	}
+
+	// Resource handles outlive their fork in Pomme. Since purged resources can't be reloaded
+	// once the fork is gone, bring them back in while we still can, and detach them from
+	// the fork's metadata, which is about to be destroyed.
+	for (Handle handle : Pomme::Memory::GetResourceHandles(refNum))
+	{
+		auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(handle);
+		blockDescriptor->SetPurgeable(false);
+		LoadResource(handle);
+		blockDescriptor->SetRezMeta(nullptr);
+	}
+
 	//UpdateResFile(refNum); // MMT:1-110
 	Pomme::Files::CloseStream(refNum);
 
 	auto it = gResForkStack.begin();
 	while (it != gResForkStack.end())
 	{
-		if (it->fileRefNum == refNum)
+		if ((*it)->fileRefNum == refNum)
+		{
+			UnindexResourceFork(**it);
 			it = gResForkStack.erase(it);
+		}
 		else
+		{
 			it++;
+		}
 	}
 
 	gResForkStackIndex = std::min(gResForkStackIndex, (int) gResForkStack.size() - 1);
@@ -211,88 +633,74 @@ short Count1Resources(ResType theType)
 {
 	gLastResError = noErr;
 
-	try
-	{
-		return (short) GetCurRF().resourceMap.at(theType).size();
-	}
-	catch (std::out_of_range&)
-	{
-		return 0;
-	}
+	const auto* typeRange = FindType(GetCurRF(), theType);
+	return typeRange ? (short) typeRange->count : 0;
 }
 
 short Count1Types()
 {
-	return (short) GetCurRF().resourceMap.size();
+	return (short) GetCurRF().types.size();
 }
 
 void Get1IndType(ResType* theType, short index)
 {
-	const auto& resourceMap = GetCurRF().resourceMap;
-
-	for (auto& it : resourceMap)
-	{
-		if (index == 1)			// remember, index is 1-based here
-		{
-			*theType = it.first;
-			return;
-		}
-
-		index--;
-	}
+	const auto& types = GetCurRF().types;
 
-	*theType = 0;
+	// remember, index is 1-based here
+	if (index >= 1 && index <= (short) types.size())
+		*theType = types[index - 1].type;
+	else
+		*theType = 0;
 }
 
 Handle GetResource(ResType theType, short theID)
 {
 	gLastResError = noErr;
 
-	for (int i = gResForkStackIndex; i >= 0; i--)
-	{
-		const auto& fork = gResForkStack[i];
+	const auto* metaPtr = FindResource(theType, theID);
 
-		if (fork.resourceMap.end() == fork.resourceMap.find(theType))
-			continue;
-
-		auto& resourcesOfType = fork.resourceMap.at(theType);
-		if (resourcesOfType.end() == resourcesOfType.find(theID))
-			continue;
-
-		// Found it!
-		const auto& meta = fork.resourceMap.at(theType).at(theID);
-		auto& forkStream = Pomme::Files::GetStream(gResForkStack[i].fileRefNum);
-
-		// Allocate handle
-		Handle handle = NewHandle(meta.size);
+	if (!metaPtr)
+	{
+		gLastResError = resNotFound;
+		return nil;
+	}
 
-		// Set pointer to resource metadata
-		Pomme::Memory::BlockDescriptor::HandleToBlock(handle)->rezMeta = &meta;
+	const auto& meta = *metaPtr;
 
-		forkStream.seekg(meta.dataOffset, std::ios::beg);
-		forkStream.read(*handle, meta.size);
+	// Use the prefetched data if it's ready. Otherwise, allocate a handle,
+	// and fill it unless it's a view of the fork.
+	Handle handle = TakePrefetchedResource(meta);
+	if (!handle)
+	{
+		auto& fork = GetFork(meta);
+		std::lock_guard<std::mutex> forkLock(fork.streamMutex);
 
-		return handle;
+		if (Ptr view = MapResourceData(fork, meta))
+		{
+			handle = &Pomme::Memory::BlockDescriptor::AllocateFileViewHandle(view, meta.size)->ptrToData;
+		}
+		else
+		{
+			handle = NewHandle(GetResourceSize(fork, meta));
+			ReadResourceData(fork, handle, meta);
+		}
 	}
 
-	gLastResError = resNotFound;
-	return nil;
+	AttachResourceMetadata(handle, meta);
+	return handle;
 }
 
 Handle Get1IndResource(ResType theType, short index)
 {
 	gLastResError = noErr;
 
-	const auto& idsToResources = GetCurRF().resourceMap.at(theType);
+	const auto& fork = GetCurRF();
+	const auto* typeRange = FindType(fork, theType);
 
-	for (auto& it : idsToResources)
+	// remember, index is 1-based here
+	if (typeRange && index >= 1 && index <= (short) typeRange->count)
 	{
-		if (index == 1)			// remember, index is 1-based here
-		{
-			return GetResource(theType, it.second.id);
-		}
-
-		index--;
+		return GetResource(theType, fork.resources[typeRange->first + index - 1].id);
 	}
 
 	gLastResError = resNotFound;
@@ -327,6 +735,49 @@ void GetResInfo(Handle theResource, short* theID, ResType* theType, char* name25
 		snprintf(name256, 256, "%s", blockDescriptor->rezMeta->name.c_str());
 }
 
+void LoadResource(Handle theResource)
+{
+	gLastResError = noErr;
+
+	if (!theResource)
+	{
+		gLastResError = resNotFound;
+		return;
+	}
+
+	auto* blockDescriptor = Pomme::Memory::BlockDescriptor::HandleToBlock(theResource);
+
+	if (!blockDescriptor->rezMeta)
+	{
+		gLastResError = resNotFound;
+		return;
+	}
+
+	if (*theResource)
+	{
+		// Still in memory
+		return;
+	}
+
+	const auto& meta = *blockDescriptor->rezMeta;
+	auto& fork = GetFork(meta);
+	std::lock_guard<std::mutex> forkLock(fork.streamMutex);
+
+	if (Ptr view = MapResourceData(fork, meta))
+	{
+		blockDescriptor->AdoptFileView(view, meta.size);
+	}
+	else
+	{
+		// The handle is empty, so refill it directly rather than via ReallocateHandle,
+		// which refuses locked handles
+		blockDescriptor->Resize((uint32_t) GetResourceSize(fork, meta));
+		ReadResourceData(fork, theResource, meta);
+	}
+
+	LOG << "reloaded purged resource " << FourCCString(meta.type) << " #" << meta.id << "\n";
+}
+
 void ReleaseResource(Handle theResource)
 {
 	DisposeHandle(theResource);
@@ -371,7 +822,7 @@ void DetachResource(Handle theResource)
 	if (!blockDescriptor->rezMeta)
 		gLastResError = resNotFound;
 
-	blockDescriptor->rezMeta = nullptr;
+	blockDescriptor->SetRezMeta(nullptr);
 }
 
 long GetResourceSizeOnDisk(Handle theResource)
@@ -386,3 +837,175 @@ long SizeResource(Handle theResource)
 {
 	return GetResourceSizeOnDisk(theResource);
 }
+
+// Does the work of Pomme_GetResources. `outHandles` must start out all nil.
+// May throw, leaving some handles in `outHandles`.
+static void GetResourceBatch(const ResType* types, const short* ids, int n, Handle* outHandles)
+{
+	struct PendingRead
+	{
+		const ResourceMetadata* meta;
+		Handle* handle;
+	};
+
+	std::vector<PendingRead> pendingReads;
+
+	for (int i = 0; i < n; i++)
+	{
+		const auto* meta = FindResource(types[i], ids[i]);
+		if (!meta)
+		{
+			gLastResError = resNotFound;
+		}
+		else if (Handle prefetched = TakePrefetchedResource(*meta))
+		{
+			outHandles[i] = prefetched;
+			AttachResourceMetadata(prefetched, *meta);
+		}
+		else
+		{
+			pendingReads.push_back({ meta, &outHandles[i] });
+		}
+	}
+
+	// Visit each fork's resources in the order in which they're laid out in the file
+	std::sort(pendingReads.begin(), pendingReads.end(), [](const PendingRead& a, const PendingRead& b)
+	{
+		return a.meta->forkRefNum != b.meta->forkRefNum
+			? a.meta->forkRefNum < b.meta->forkRefNum
+			: a.meta->dataOffset < b.meta->dataOffset;
+	});
+
+	auto forkBegin = pendingReads.begin();
+	while (forkBegin != pendingReads.end())
+	{
+		auto forkEnd = std::find_if(forkBegin, pendingReads.end(),
+			[&](const PendingRead& r) { return r.meta->forkRefNum != forkBegin->meta->forkRefNum; });
+
+		auto& fork = GetFork(*forkBegin->meta);
+		std::lock_guard<std::mutex> forkLock(fork.streamMutex);
+
+		// Allocate all handles up front. Large resources may become views of the fork, which need no reading.
+		auto readsEnd = forkBegin;
+		for (auto it = forkBegin; it != forkEnd; ++it)
+		{
+			const auto& meta = *it->meta;
+			if (Ptr view = MapResourceData(fork, meta))
+			{
+				*it->handle = &Pomme::Memory::BlockDescriptor::AllocateFileViewHandle(view, meta.size)->ptrToData;
+			}
+			else
+			{
+				*it->handle = NewHandle(GetResourceSize(fork, meta));
+				*readsEnd++ = *it;
+			}
+			AttachResourceMetadata(*it->handle, meta);
+		}
+
+		// Coalesce neighboring small resources into runs, and read each run in one go.
+		// There's no point in doing that if the fork is memory-mapped: all reads are memcpys then.
+		auto runBegin = forkBegin;
+		while (runBegin != readsEnd)
+		{
+			bool coalesce = fork.mappedBytes.empty() && runBegin->meta->size <= kMaxCoalescedResourceSize;
+
+			std::streamoff runStartOff = runBegin->meta->dataOffset;
+			std::streamoff runEndOff = runStartOff + runBegin->meta->size;
+
+			auto runEnd = runBegin + 1;
+			while (coalesce && runEnd != readsEnd)
+			{
+				const auto& next = *runEnd->meta;
+				std::streamoff nextEnd = std::max(runEndOff, next.dataOffset + next.size);
+				if (next.size > kMaxCoalescedResourceSize
+					|| next.dataOffset > runEndOff + kMaxCoalescedGap
+					|| nextEnd - runStartOff > kMaxCoalescedRunSize)
+					break;
+
+				runEndOff = nextEnd;
+				++runEnd;
+			}
+
+			if (runEnd - runBegin == 1)
+			{
+				ReadResourceData(fork, *runBegin->handle, *runBegin->meta);
+			}
+			else
+			{
+				Pomme::ScratchScope scratch;
+				char* buffer = scratch.AllocArray<char>(runEndOff - runStartOff);
+
+				fork.stream->seekg(runStartOff, std::ios::beg);
+				fork.stream->read(buffer, runEndOff - runStartOff);
+
+				for (auto it = runBegin; it != runEnd; ++it)
+					memcpy(**it->handle, buffer + (it->meta->dataOffset - runStartOff), it->meta->size);
+			}
+
+			runBegin = runEnd;
+		}
+
+		forkBegin = forkEnd;
+	}
+}
+
+void Pomme_GetResources(const ResType* types, const short* ids, int n, Handle* outHandles)
+{
+	gLastResError = noErr;
+
+	for (int i = 0; i < n; i++)
+		outHandles[i] = nil;
+
+	try
+	{
+		GetResourceBatch(types, ids, n, outHandles);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Pomme_GetResources: " << e.what() << "\n";
+
+		// Don't hand out a partial batch
+		for (int i = 0; i < n; i++)
+		{
+			if (outHandles[i])
+			{
+				DisposeHandle(outHandles[i]);
+				outHandles[i] = nil;
+			}
+		}
+
+		gLastResError = dynamic_cast<const std::bad_alloc*>(&e) ? memFullErr : ioErr;
+	}
+}
+
+void Pomme_PrefetchResources(const ResType* types, const short* ids, int n)
+{
+	std::vector<PrefetchRequest> requests;
+
+	for (int i = 0; i < n; i++)
+	{
+		if (const auto* meta = FindResource(types[i], ids[i]))
+			requests.push_back({ &GetFork(*meta), meta });
+	}
+
+	if (requests.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(gPrefetchMutex);
+		gPrefetchThread.Start();
+		gPrefetchQueue.insert(gPrefetchQueue.end(), requests.begin(), requests.end());
+	}
+
+	gPrefetchCondition.notify_one();
+}
+
+void Pomme_SetResourceMapCacheDirectory(const char* hostPath)
+{
+	ResourceMapCache::SetDirectory(hostPath ? fs::path(hostPath) : fs::path());
+}
+
+void Pomme_SetPurgeableResources(Boolean enable)
+{
+	gPurgeableResources.store(enable, std::memory_order_relaxed);
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <memory>
+#include <span>
 #include "Utilities/StringUtils.h"
+#include "CompilerSupport/filesystem.h"
 
 namespace Pomme::Files
 {
@@ -28,6 +30,28 @@ namespace Pomme::Files
 	public:
 		virtual std::iostream& GetStream() = 0;
 
+		// Forks whose entire contents are in memory (e.g. memory-mapped forks) return them; others return an empty span.
+		virtual std::span<char> GetMappedBytes()
+		{
+			return {};
+		}
+
+		// Memory-mapped forks may return a private, copy-on-write view of `size` bytes of their
+		// backing file starting at stream position `offset` (see PageAllocator::MapFileView).
+		// Returns nullptr if the fork doesn't support it.
+		virtual char* MapView(std::streamoff offset, size_t size)
+		{
+			(void) offset;
+			(void) size;
+			return nullptr;
+		}
+
+		// Forks backed by a file on the host filesystem return its path; others return an empty path.
+		virtual fs::path GetHostPath() const
+		{
+			return {};
+		}
+
 		virtual ~ForkHandle() = default;
 	};
 
@@ -139,10 +139,12 @@ static PicHandle GetPictureFromStream(std::istream& stream, bool skip512)
 
 	// Tack the data onto the end of the Picture struct,
 	// so that DisposeHandle frees both the Picture and the data.
-	PicHandle ph = (PicHandle) NewHandle(int(sizeof(Picture) + pm.data.size()));
+	// Keep the pixels on a cache line boundary.
+	constexpr size_t pixelsOffset = (sizeof(Picture) + Memory::kCacheLineSize - 1) & ~(Memory::kCacheLineSize - 1);
+	PicHandle ph = (PicHandle) NewHandleAligned(int(pixelsOffset + pm.data.size()), Memory::kCacheLineSize);
 
 	Picture& pic = **ph;
-	Ptr pixels = (Ptr) *ph + sizeof(Picture);
+	Ptr pixels = (Ptr) *ph + pixelsOffset;
 
 	pic.picFrame = Rect{0, 0, (SInt16) pm.height, (SInt16) pm.width};
 	pic.picSize = -1;
@@ -150,6 +152,9 @@ static PicHandle GetPictureFromStream(std::istream& stream, bool skip512)
 
 	memcpy(pic.__pomme_pixelsARGB32, pm.data.data(), pm.data.size());
 
+	// __pomme_pixelsARGB32 points into the handle's own payload, so the payload must never move
+	HLock((Handle) ph);
+
 	return ph;
 }
 
@@ -1,10 +1,13 @@
 #include "Pomme.h"
 #include "PommeGraphics.h"
 #include "Utilities/bigendianstreams.h"
+#include "Utilities/ScratchArena.h"
 
+#include <algorithm>
 #include <list>
 #include <fstream>
 #include <iostream>
+#include <span>
 #include <vector>
 
 using namespace Pomme;
@@ -77,12 +80,19 @@ void Pomme::Graphics::DumpTGA(const char* path, short width, short height, const
 //-----------------------------------------------------------------------------
 // PackBits
 
+// Unpacks one row into `out`, which can hold up to `outCapacity` items. Returns the number of items unpacked.
 template<typename T>
-static std::vector<T> UnpackBits(BigEndianIStream& f, UInt16 rowbytes, int packedLength)
+static size_t UnpackBits(BigEndianIStream& f, UInt16 rowbytes, int packedLength, T* out, size_t outCapacity)
 {
 	//LOG << "UnpackBits rowbytes=" << rowbytes << " packedlength=" << packedLength << "\n";
 
-	std::vector<T> unpacked;
+	size_t numUnpacked = 0;
+
+	auto CheckRoom = [&](size_t count)
+	{
+		if (numUnpacked + count > outCapacity)
+			throw PICTException("UnpackBits: too many items");
+	};
 
 	if (rowbytes < 8)
 	{
@@ -90,9 +100,10 @@ static std::vector<T> UnpackBits(BigEndianIStream& f, UInt16 rowbytes, int packe
 		LOG << "Bits aren't compressed\n";
 		for (int j = 0; j < packedLength; j += sizeof(T))
 		{
-			unpacked.push_back(f.Read<T>());
+			CheckRoom(1);
+			out[numUnpacked++] = f.Read<T>();
 		}
-		return unpacked;
+		return numUnpacked;
 	}
 
 	for (int j = 0; j < packedLength;)
@@ -109,59 +120,60 @@ static std::vector<T> UnpackBits(BigEndianIStream& f, UInt16 rowbytes, int packe
 			// Packed data.
 			int len = ((FlagCounter ^ 0xFF) & 0xFF) + 2;
 			auto item = f.Read<T>();
-			for (int k = 0; k < len; k++)
-			{
-				unpacked.push_back(item);
-			}
+			CheckRoom(len);
+			std::fill(out + numUnpacked, out + numUnpacked + len, item);
+			numUnpacked += len;
 			j += 1 + sizeof(T);
 		}
 		else
 		{
 			// Unpacked data
 			int len = (FlagCounter & 0xFF) + 1;
+			CheckRoom(len);
 			for (int k = 0; k < len; k++)
 			{
-				unpacked.push_back(f.Read<T>());
+				out[numUnpacked++] = f.Read<T>();
 			}
 			j += 1 + len * sizeof(T);
 		}
 	}
 
-	return unpacked;
+	return numUnpacked;
 }
 
 //-----------------------------------------------------------------------------
 // Unpack PICT pixmap formats
 
+// The unpacked items are allocated from `scratch` and only live as long as it does.
 template<typename T>
-static std::vector<T> UnpackAllRows(BigEndianIStream& f, int w, int h, UInt16 rowbytes, std::size_t expectedItemCount)
+static std::span<T> UnpackAllRows(ScratchScope& scratch, BigEndianIStream& f, int w, int h, UInt16 rowbytes, std::size_t expectedItemCount)
 {
 	(void) w;
 
 	LOG << "UnpackBits<" << typeid(T).name() << ">";
 
-	std::vector<T> data;
-	data.reserve(expectedItemCount);
+	T* data = scratch.AllocArray<T>(expectedItemCount);
+	size_t numUnpacked = 0;
 	for (int y = 0; y < h; y++)
 	{
 		int packedRowBytes = rowbytes > 250 ? f.Read<UInt16>() : f.Read<UInt8>();
-		std::vector<T> rowPixels = UnpackBits<T>(f, rowbytes, packedRowBytes);
-		data.insert(data.end(), rowPixels.begin(), rowPixels.end());
+		numUnpacked += UnpackBits<T>(f, rowbytes, packedRowBytes, data + numUnpacked, expectedItemCount - numUnpacked);
 	}
 
-	if (expectedItemCount != data.size())
+	if (expectedItemCount != numUnpacked)
 	{
 		throw PICTException("UnpackAllRows: unexpected item count");
 	}
 
 	LOG_NOPREFIX << "\n";
-	return data;
+	return std::span<T>(data, numUnpacked);
 }
 
 // Unpack pixel type 0 (8-bit indexed)
 static ARGBPixmap Unpack0(BigEndianIStream& f, int w, int h, const std::vector<Color>& palette)
 {
-	auto unpacked = UnpackAllRows<UInt8>(f, w, h, w, w * h);
+	ScratchScope scratch;
+	auto unpacked = UnpackAllRows<UInt8>(scratch, f, w, h, w, w * h);
 	ARGBPixmap dst(w, h);
 	dst.data.clear();
 	LOG << "indexed to RGBA";
@@ -184,7 +196,8 @@ static ARGBPixmap Unpack0(BigEndianIStream& f, int w, int h, const std::vector<C
 // Unpack pixel type 4 (16 bits, chunky)
 static ARGBPixmap Unpack3(BigEndianIStream& f, int w, int h, UInt16 rowbytes)
 {
-	auto unpacked = UnpackAllRows<UInt16>(f, w, h, rowbytes, w * h);
+	ScratchScope scratch;
+	auto unpacked = UnpackAllRows<UInt16>(scratch, f, w, h, rowbytes, w * h);
 	ARGBPixmap dst(w, h);
 	dst.data.clear();
 	dst.data.reserve(unpacked.size() * 4);
@@ -207,7 +220,8 @@ static ARGBPixmap Unpack3(BigEndianIStream& f, int w, int h, UInt16 rowbytes)
 // Unpack pixel type 4 (24 or 32 bits, planar)
 static ARGBPixmap Unpack4(BigEndianIStream& f, int w, int h, UInt16 rowbytes, int numPlanes)
 {
-	auto unpacked = UnpackAllRows<Byte>(f, w, h, rowbytes, numPlanes * w * h);
+	ScratchScope scratch;
+	auto unpacked = UnpackAllRows<Byte>(scratch, f, w, h, rowbytes, numPlanes * w * h);
 	ARGBPixmap dst(w, h);
 	dst.data.clear();
 	LOG << "Planar" << numPlanes*8 << " to RGBA";
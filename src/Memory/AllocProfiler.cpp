@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "PommeFiles.h"
+#include "Memory/AllocProfiler.h"
+
+using namespace Pomme::Memory;
+
+//-----------------------------------------------------------------------------
+// Allocation profiler
+//
+// Keeps live byte/block counts and allocation counts for each power-of-two size class,
+// each allocation tag, and each resource type. Only compiled in if POMME_ALLOC_PROFILING is set.
+
+struct ProfileCounters
+{
+	size_t liveBytes = 0;
+	size_t liveBlocks = 0;
+	uint64_t totalAllocs = 0;
+	uint64_t totalAllocsAtLastSample = 0;
+
+	void Add(size_t bytes, bool isNewAlloc)
+	{
+		liveBytes += bytes;
+		liveBlocks++;
+		if (isNewAlloc)
+			totalAllocs++;
+	}
+
+	void Remove(size_t bytes)
+	{
+		liveBytes -= bytes;
+		liveBlocks--;
+	}
+};
+
+static constexpr int kNumSizeBuckets = 32;
+
+static std::mutex gProfileMutex;
+static ProfileCounters gSizeBuckets[kNumSizeBuckets];
+static std::unordered_map<const char*, ProfileCounters> gTags;
+static std::unordered_map<ResType, ProfileCounters> gResourceTypes;
+static auto gLastSampleTime = std::chrono::steady_clock::now();
+
+static thread_local const char* tCurrentTag = nullptr;
+
+static const char* kUntagged = "(untagged)";
+
+// Bucket N holds blocks of up to 2^(N+4) bytes.
+static int GetSizeBucket(uint32_t size)
+{
+	int bucket = 0;
+	while (bucket < kNumSizeBuckets - 1 && size > (16u << bucket))
+		bucket++;
+	return bucket;
+}
+
+static const char* GetTagKey(const BlockDescriptor* block)
+{
+	return block->tag ? block->tag : kUntagged;
+}
+
+void AllocProfiler::OnAlloc(BlockDescriptor* block)
+{
+	block->tag = tCurrentTag;
+
+	std::lock_guard<std::mutex> lock(gProfileMutex);
+	gSizeBuckets[GetSizeBucket(block->size)].Add(block->size, true);
+	gTags[GetTagKey(block)].Add(block->size, true);
+}
+
+void AllocProfiler::OnFree(const BlockDescriptor* block)
+{
+	std::lock_guard<std::mutex> lock(gProfileMutex);
+	gSizeBuckets[GetSizeBucket(block->size)].Remove(block->size);
+	gTags[GetTagKey(block)].Remove(block->size);
+	if (block->rezMeta)
+		gResourceTypes[block->rezMeta->type].Remove(block->size);
+}
+
+void AllocProfiler::OnResize(const BlockDescriptor* block, uint32_t newSize)
+{
+	std::lock_guard<std::mutex> lock(gProfileMutex);
+
+	gSizeBuckets[GetSizeBucket(block->size)].Remove(block->size);
+	gSizeBuckets[GetSizeBucket(newSize)].Add(newSize, false);
+
+	auto& tagCounters = gTags[GetTagKey(block)];
+	tagCounters.Remove(block->size);
+	tagCounters.Add(newSize, false);
+
+	if (block->rezMeta)
+	{
+		auto& typeCounters = gResourceTypes[block->rezMeta->type];
+		typeCounters.Remove(block->size);
+		typeCounters.Add(newSize, false);
+	}
+}
+
+void AllocProfiler::OnSetRezMeta(const BlockDescriptor* block, const Pomme::Files::ResourceMetadata* newRezMeta)
+{
+	std::lock_guard<std::mutex> lock(gProfileMutex);
+
+	if (block->rezMeta)
+		gResourceTypes[block->rezMeta->type].Remove(block->size);
+
+	// The allocation itself was already counted in OnAlloc; only move the block into its type's bucket
+	if (newRezMeta)
+		gResourceTypes[newRezMeta->type].Add(block->size, false);
+}
+
+//-----------------------------------------------------------------------------
+// Query API
+
+static AllocProfileEntry MakeEntry(std::string name, ProfileCounters& counters, double secondsSinceLastSample)
+{
+	AllocProfileEntry entry;
+	entry.name = std::move(name);
+	entry.liveBytes = counters.liveBytes;
+	entry.liveBlocks = counters.liveBlocks;
+	entry.totalAllocs = counters.totalAllocs;
+	entry.allocsPerSecond = secondsSinceLastSample <= 0 ? 0
+		: double(counters.totalAllocs - counters.totalAllocsAtLastSample) / secondsSinceLastSample;
+	counters.totalAllocsAtLastSample = counters.totalAllocs;
+	return entry;
+}
+
+static void SortByLiveBytes(std::vector<AllocProfileEntry>& entries)
+{
+	std::sort(entries.begin(), entries.end(),
+		[](const AllocProfileEntry& a, const AllocProfileEntry& b) { return a.liveBytes > b.liveBytes; });
+}
+
+AllocProfile Pomme::Memory::GetAllocProfile()
+{
+	std::lock_guard<std::mutex> lock(gProfileMutex);
+
+	auto now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - gLastSampleTime).count();
+	gLastSampleTime = now;
+
+	AllocProfile profile;
+
+	for (int i = 0; i < kNumSizeBuckets; i++)
+	{
+		if (gSizeBuckets[i].totalAllocs == 0 && gSizeBuckets[i].liveBlocks == 0)
+			continue;
+		char name[32];
+		snprintf(name, sizeof(name), "<= %llu bytes", 16ull << i);
+		profile.bySizeClass.push_back(MakeEntry(name, gSizeBuckets[i], seconds));
+	}
+
+	// Several call sites may use distinct pointers to equal tag strings; merge them
+	std::unordered_map<std::string, size_t> tagIndices;
+	for (auto& [tag, counters] : gTags)
+	{
+		AllocProfileEntry entry = MakeEntry(tag, counters, seconds);
+		auto [it, isNew] = tagIndices.try_emplace(entry.name, profile.byTag.size());
+		if (isNew)
+		{
+			profile.byTag.push_back(entry);
+		}
+		else
+		{
+			auto& merged = profile.byTag[it->second];
+			merged.liveBytes += entry.liveBytes;
+			merged.liveBlocks += entry.liveBlocks;
+			merged.totalAllocs += entry.totalAllocs;
+			merged.allocsPerSecond += entry.allocsPerSecond;
+		}
+	}
+
+	for (auto& [type, counters] : gResourceTypes)
+	{
+		profile.byResourceType.push_back(MakeEntry(Pomme::FourCCString(type), counters, seconds));
+	}
+
+	SortByLiveBytes(profile.bySizeClass);
+	SortByLiveBytes(profile.byTag);
+	SortByLiveBytes(profile.byResourceType);
+
+	return profile;
+}
+
+//-----------------------------------------------------------------------------
+// C API
+
+const char* Pomme_SetAllocTag(const char* tag)
+{
+	const char* previousTag = tCurrentTag;
+	tCurrentTag = tag;
+	return previousTag;
+}
+
+#if POMME_ALLOC_PROFILING
+static void PrintEntries(const char* title, const std::vector<AllocProfileEntry>& entries, size_t heapSize)
+{
+	printf("%-24s %12s %6s %10s %12s %10s\n", title, "live bytes", "heap%", "live blks", "total allocs", "allocs/s");
+
+	for (const auto& entry : entries)
+	{
+		printf("%-24s %12zu %5.1f%% %10zu %12llu %10.1f\n",
+			entry.name.c_str(),
+			entry.liveBytes,
+			heapSize == 0 ? 0.0 : 100.0 * double(entry.liveBytes) / double(heapSize),
+			entry.liveBlocks,
+			(unsigned long long) entry.totalAllocs,
+			entry.allocsPerSecond);
+	}
+
+	printf("\n");
+}
+#endif
+
+void Pomme_DumpAllocProfile(void)
+{
+#if !POMME_ALLOC_PROFILING
+	printf("%s: Pomme was built without POMME_ALLOC_PROFILING\n", __func__);
+#else
+	AllocProfile profile = GetAllocProfile();
+
+	size_t heapSize = 0;
+	for (const auto& entry : profile.bySizeClass)
+		heapSize += entry.liveBytes;
+
+	printf("%s: %zu live bytes\n\n", __func__, heapSize);
+	PrintEntries("SIZE CLASS", profile.bySizeClass, heapSize);
+	PrintEntries("TAG", profile.byTag, heapSize);
+	PrintEntries("RESOURCE TYPE", profile.byResourceType, heapSize);
+#endif
+}
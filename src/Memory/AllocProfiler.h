@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Pomme.h"
+#include "PommeMemory.h"
+
+namespace Pomme::Memory::AllocProfiler
+{
+	// Called when a block is born. Stamps the block with the calling thread's current tag.
+	void OnAlloc(BlockDescriptor* block);
+
+	// Called right before a block dies.
+	void OnFree(const BlockDescriptor* block);
+
+	// Called right before a block's size changes.
+	void OnResize(const BlockDescriptor* block, uint32_t newSize);
+
+	// Called right before a block's resource metadata changes.
+	void OnSetRezMeta(const BlockDescriptor* block, const Pomme::Files::ResourceMetadata* newRezMeta);
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "Pomme.h"
+#include "PommeFiles.h"
+#include "PommeMemory.h"
+
+using namespace Pomme::Memory;
+
+//-----------------------------------------------------------------------------
+// Heap snapshots
+//
+// A snapshot records every live block along with its pointer tracking ID (batch:number),
+// which uniquely identifies an allocation. Diffing two snapshots then tells which blocks
+// were allocated, retained or freed in between.
+
+static bool IsOlder(const HeapSnapshotBlock& a, const HeapSnapshotBlock& b)
+{
+	return a.batch != b.batch ? a.batch < b.batch : a.numInBatch < b.numInBatch;
+}
+
+static std::string GetSizeClassName(uint32_t size)
+{
+	unsigned long long bound = 16;
+	while (size > bound)
+		bound <<= 1;
+
+	char name[32];
+	snprintf(name, sizeof(name), "<= %llu bytes", bound);
+	return name;
+}
+
+static std::string GetResourceName(const HeapSnapshotBlock& block)
+{
+	if (!block.isResource)
+		return "(not a resource)";
+
+	char name[32];
+	snprintf(name, sizeof(name), "'%s' #%d", Pomme::FourCCString(block.rezType).c_str(), block.rezID);
+	return name;
+}
+
+static std::string GetBatchName(const HeapSnapshotBlock& block)
+{
+	return "batch " + std::to_string(block.batch);
+}
+
+PommeHeapSnapshot Pomme::Memory::TakeHeapSnapshot()
+{
+	PommeHeapSnapshot snapshot;
+
+	ForEachLiveBlock([&](const BlockDescriptor& block)
+	{
+		HeapSnapshotBlock record = {};
+		record.batch = block.ptrBatch;
+		record.numInBatch = block.ptrNumInBatch;
+		record.size = block.size;
+		if (block.rezMeta)
+		{
+			record.isResource = true;
+			record.rezType = block.rezMeta->type;
+			record.rezID = block.rezMeta->id;
+		}
+		snapshot.blocks.push_back(record);
+	});
+
+	std::sort(snapshot.blocks.begin(), snapshot.blocks.end(), IsOlder);
+
+	return snapshot;
+}
+
+HeapDiff Pomme::Memory::DiffHeapSnapshots(const PommeHeapSnapshot& before, const PommeHeapSnapshot& after)
+{
+	std::map<std::string, HeapDiffEntry> bySizeClass;
+	std::map<std::string, HeapDiffEntry> byResource;
+	std::map<std::string, HeapDiffEntry> byBatch;
+
+	enum { kAdded, kRetained, kFreed };
+
+	auto tally = [&](const HeapSnapshotBlock& block, int what)
+	{
+		for (auto* entry : { &bySizeClass[GetSizeClassName(block.size)],
+							 &byResource[GetResourceName(block)],
+							 &byBatch[GetBatchName(block)] })
+		{
+			switch (what)
+			{
+				case kAdded:	entry->addedBlocks++;		entry->addedBytes += block.size;		break;
+				case kRetained:	entry->retainedBlocks++;	entry->retainedBytes += block.size;		break;
+				case kFreed:	entry->freedBlocks++;		entry->freedBytes += block.size;		break;
+			}
+		}
+	};
+
+	// Both snapshots are sorted by tracking ID, so a single merge pass classifies every block
+	auto b = before.blocks.begin();
+	auto a = after.blocks.begin();
+	while (b != before.blocks.end() || a != after.blocks.end())
+	{
+		if (a == after.blocks.end() || (b != before.blocks.end() && IsOlder(*b, *a)))
+			tally(*b++, kFreed);
+		else if (b == before.blocks.end() || IsOlder(*a, *b))
+			tally(*a++, kAdded);
+		else
+			tally(*a++, kRetained), b++;
+	}
+
+	auto flatten = [](std::map<std::string, HeapDiffEntry>& groups)
+	{
+		std::vector<HeapDiffEntry> entries;
+		for (auto& [name, entry] : groups)
+		{
+			entry.name = name;
+			entries.push_back(entry);
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const HeapDiffEntry& x, const HeapDiffEntry& y)
+		{
+			return x.addedBytes != y.addedBytes
+				? x.addedBytes > y.addedBytes
+				: x.retainedBytes > y.retainedBytes;
+		});
+
+		return entries;
+	};
+
+	HeapDiff diff;
+	diff.bySizeClass = flatten(bySizeClass);
+	diff.byResource = flatten(byResource);
+	diff.byBatch = flatten(byBatch);
+	return diff;
+}
+
+//-----------------------------------------------------------------------------
+// C API
+
+PommeHeapSnapshot* Pomme_HeapSnapshot(void)
+{
+	return new PommeHeapSnapshot(TakeHeapSnapshot());
+}
+
+void Pomme_DisposeHeapSnapshot(PommeHeapSnapshot* snapshot)
+{
+	delete snapshot;
+}
+
+static bool CheckTrackingEnabled(const char* func)
+{
+#if !POMME_PTR_TRACKING
+	printf("%s: Pomme was built without POMME_PTR_TRACKING\n", func);
+	return false;
+#else
+	(void) func;
+	return true;
+#endif
+}
+
+static void PrintLiveEntries(const char* title, const std::vector<HeapDiffEntry>& entries)
+{
+	printf("%-24s %12s %10s\n", title, "live bytes", "live blks");
+
+	for (const auto& entry : entries)
+		printf("%-24s %12zu %10zu\n", entry.name.c_str(), entry.addedBytes, entry.addedBlocks);
+
+	printf("\n");
+}
+
+static void PrintDiffEntries(const char* title, const std::vector<HeapDiffEntry>& entries)
+{
+	printf("%-24s %12s %10s %12s %10s %12s %10s\n", title,
+		"added bytes", "added blks", "kept bytes", "kept blks", "freed bytes", "freed blks");
+
+	for (const auto& entry : entries)
+	{
+		printf("%-24s %12zu %10zu %12zu %10zu %12zu %10zu\n",
+			entry.name.c_str(),
+			entry.addedBytes, entry.addedBlocks,
+			entry.retainedBytes, entry.retainedBlocks,
+			entry.freedBytes, entry.freedBlocks);
+	}
+
+	printf("\n");
+}
+
+void Pomme_DumpHeapSnapshot(const PommeHeapSnapshot* snapshot)
+{
+	if (!CheckTrackingEnabled(__func__))
+		return;
+
+	// Diffing against an empty snapshot groups the live blocks
+	HeapDiff groups = DiffHeapSnapshots(PommeHeapSnapshot(), *snapshot);
+
+	size_t liveBytes = 0;
+	for (const auto& block : snapshot->blocks)
+		liveBytes += block.size;
+
+	printf("%s: %zu live blocks, %zu live bytes\n\n", __func__, snapshot->blocks.size(), liveBytes);
+	PrintLiveEntries("SIZE CLASS", groups.bySizeClass);
+	PrintLiveEntries("RESOURCE", groups.byResource);
+	PrintLiveEntries("TRACKING BATCH", groups.byBatch);
+}
+
+void Pomme_DumpHeapDiff(const PommeHeapSnapshot* before, const PommeHeapSnapshot* after)
+{
+	if (!CheckTrackingEnabled(__func__))
+		return;
+
+	HeapDiff diff = DiffHeapSnapshots(*before, *after);
+
+	printf("%s: %zu -> %zu live blocks\n\n", __func__, before->blocks.size(), after->blocks.size());
+	PrintDiffEntries("SIZE CLASS", diff.bySizeClass);
+	PrintDiffEntries("RESOURCE", diff.byResource);
+	PrintDiffEntries("TRACKING BATCH", diff.byBatch);
+}
@@ -1,8 +1,22 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <iostream>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "Pomme.h"
+#include "PommeFiles.h"
 #include "PommeMemory.h"
+#include "Memory/AllocProfiler.h"
+#include "Memory/PageAllocator.h"
+#include "Memory/RelocatableHeap.h"
 
 using namespace Pomme;
 using namespace Pomme::Memory;
@@ -10,63 +24,971 @@ using namespace Pomme::Memory;
 #define LOG POMME_GENLOG(POMME_DEBUG_MEMORY, "MEMO")
 
 #if POMME_PTR_TRACKING
-#include <set>
-static uint32_t gCurrentPtrBatch = 0;
-static uint32_t gCurrentNumPtrsInBatch = 0;
-static std::set<uint32_t> gLivePtrNums;
+// Live blocks are spread over several lists, picked by descriptor address, so that threads
+// allocating at the same time rarely contend for the same lock. Flushing locks every shard.
+struct alignas(64) LiveBlockShard
+{
+	std::mutex mutex;
+	BlockDescriptor* head = nullptr;		// most recent first
+};
+
+static constexpr size_t kNumLiveBlockShards = 16;
+static LiveBlockShard gLiveBlockShards[kNumLiveBlockShards];
+
+// Only written while all shards are locked, so reading them under any one shard lock is consistent
+static std::atomic<uint32_t> gCurrentPtrBatch = 0;
+static std::atomic<uint32_t> gCurrentNumPtrsInBatch = 0;
+
+static LiveBlockShard& GetLiveBlockShard(const BlockDescriptor* block)
+{
+	// Descriptors are at least 64 bytes apart
+	return gLiveBlockShards[((uintptr_t) block / 64) % kNumLiveBlockShards];
+}
+
+static std::array<std::unique_lock<std::mutex>, kNumLiveBlockShards> LockAllLiveBlockShards()
+{
+	std::array<std::unique_lock<std::mutex>, kNumLiveBlockShards> locks;
+	for (size_t i = 0; i < kNumLiveBlockShards; i++)
+		locks[i] = std::unique_lock<std::mutex>(gLiveBlockShards[i].mutex);
+	return locks;
+}
 #endif
 
-static constexpr int kBlockDescriptorPadding = 32;
+static constexpr int kBlockDescriptorPadding = 64;
 static_assert(sizeof(BlockDescriptor) <= kBlockDescriptorPadding);
 
-static size_t gTotalHeapSize = 0;
-static size_t gNumBlocksAllocated = 0;
+// Statistics only need to add up eventually, so relaxed atomics are enough.
+static std::atomic<size_t> gTotalHeapSize = 0;
+static std::atomic<size_t> gNumBlocksAllocated = 0;
+
+// Result of the last SetHandleSize/ReallocateHandle on this thread (see MemError)
+static thread_local OSErr tLastMemError = noErr;
 
 //-----------------------------------------------------------------------------
-// Implementation-specific stuff
+// Slab allocator
+//
+// Small blocks are carved out of large pages and recycled through per-size-class
+// free lists, so that games that churn through thousands of small Ptrs per level
+// don't pay for a trip through the general-purpose heap on every NewPtr/DisposePtr.
+// Slab pages are kept around for the lifetime of the process.
+
+#if POMME_SLAB_ALLOCATOR
 
-BlockDescriptor* BlockDescriptor::Allocate(uint32_t size)
+static constexpr size_t kSlabPageSize = 64 * 1024;
+static constexpr size_t kSlabGranularity = 16;
+static constexpr size_t kSlabMaxBlockSize = 4096;
+
+// 16-byte steps up to 256, then 4 classes per doubling up to kSlabMaxBlockSize.
+static constexpr int kNumSizeClasses = 32;
+
+static constexpr std::array<uint32_t, kNumSizeClasses> kSizeClassBytes = []()
 {
-	char* buf = new char[kBlockDescriptorPadding + size];
+	std::array<uint32_t, kNumSizeClasses> classes{};
+	int i = 0;
+	for (uint32_t size = 16; size <= 256; size += 16)
+		classes[i++] = size;
+	for (uint32_t pow2 = 256; pow2 < kSlabMaxBlockSize; pow2 *= 2)
+		for (uint32_t quarter = 1; quarter <= 4; quarter++)
+			classes[i++] = pow2 + quarter * pow2 / 4;
+	return classes;
+}();
 
-	BlockDescriptor* block = (BlockDescriptor*) buf;
+static_assert(kSizeClassBytes[kNumSizeClasses - 1] == kSlabMaxBlockSize);
+
+// Maps (size + 15) / 16 to the index of the smallest size class that fits.
+static constexpr std::array<uint8_t, kSlabMaxBlockSize / kSlabGranularity + 1> kSizeToClass = []()
+{
+	std::array<uint8_t, kSlabMaxBlockSize / kSlabGranularity + 1> lut{};
+	int sizeClass = 0;
+	for (size_t i = 0; i < lut.size(); i++)
+	{
+		while (kSizeClassBytes[sizeClass] < i * kSlabGranularity)
+			sizeClass++;
+		lut[i] = (uint8_t) sizeClass;
+	}
+	return lut;
+}();
+
+// A freed slab block stores its free-list link in its *second* word,
+// so that a dead BlockDescriptor keeps its 'DEAD' magic for double-free detection.
+struct SlabFreeLink
+{
+	void* unused;
+	SlabFreeLink* next;
+};
+
+static_assert(sizeof(SlabFreeLink) <= kSizeClassBytes[0]);
+
+struct SizeClass
+{
+	SlabFreeLink* freeList = nullptr;
+	char* bumpCursor = nullptr;
+	char* bumpEnd = nullptr;
+};
+
+static SizeClass gSizeClasses[kNumSizeClasses];
+static std::mutex gSlabMutex;
+
+static int GetSizeClass(size_t size)
+{
+	return kSizeToClass[(size + kSlabGranularity - 1) / kSlabGranularity];
+}
+
+// Pops a block off the shared free lists. Caller must hold gSlabMutex.
+static char* CentralSlabAlloc(int sizeClassIndex)
+{
+	SizeClass& sc = gSizeClasses[sizeClassIndex];
+	const size_t blockSize = kSizeClassBytes[sizeClassIndex];
+
+	if (sc.freeList)
+	{
+		SlabFreeLink* link = sc.freeList;
+		sc.freeList = link->next;
+		return (char*) link;
+	}
+
+	if (sc.bumpCursor + blockSize > sc.bumpEnd)
+	{
+		sc.bumpCursor = new char[kSlabPageSize];
+		sc.bumpEnd = sc.bumpCursor + kSlabPageSize;
+		LOG << "new slab page for " << blockSize << "-byte blocks\n";
+	}
+
+	char* buf = sc.bumpCursor;
+	sc.bumpCursor += blockSize;
+	return buf;
+}
+
+// Pushes a block onto the shared free lists. Caller must hold gSlabMutex.
+static void CentralSlabFree(char* buf, int sizeClassIndex)
+{
+	SizeClass& sc = gSizeClasses[sizeClassIndex];
+	SlabFreeLink* link = (SlabFreeLink*) buf;
+	link->next = sc.freeList;
+	sc.freeList = link;
+}
+
+//-----------------------------------------------------------------------------
+// Per-thread slab caches
+//
+// Each thread keeps a small stash of free blocks per size class, so that the common
+// NewPtr/DisposePtr path doesn't need to take gSlabMutex. Blocks move between a thread's
+// cache and the shared free lists in batches.
+
+static constexpr size_t kThreadCacheBytesPerClass = 32 * 1024;
+
+static int GetThreadCacheLimit(int sizeClassIndex)
+{
+	return (int) std::clamp<size_t>(kThreadCacheBytesPerClass / kSizeClassBytes[sizeClassIndex], 4, 256);
+}
+
+// Trivially destructible, so it remains usable while the thread's other TLS objects are torn down.
+struct ThreadCache
+{
+	SlabFreeLink* freeList[kNumSizeClasses];
+	int count[kNumSizeClasses];
+	bool retired;		// set once the thread is exiting; the thread then uses the shared lists directly
+};
+
+static thread_local ThreadCache tCache;
+
+// Gives a thread's cached blocks back to the shared lists when the thread exits.
+struct ThreadCacheRetirer
+{
+	bool armed = false;
+
+	~ThreadCacheRetirer()
+	{
+		std::lock_guard<std::mutex> lock(gSlabMutex);
+		for (int i = 0; i < kNumSizeClasses; i++)
+		{
+			while (tCache.freeList[i])
+			{
+				SlabFreeLink* link = tCache.freeList[i];
+				tCache.freeList[i] = link->next;
+				CentralSlabFree((char*) link, i);
+			}
+			tCache.count[i] = 0;
+		}
+		tCache.retired = true;
+	}
+};
+
+static thread_local ThreadCacheRetirer tCacheRetirer;
+
+static char* SlabAlloc(int sizeClassIndex)
+{
+	ThreadCache& cache = tCache;
+
+	if (!cache.freeList[sizeClassIndex])
+	{
+		std::lock_guard<std::mutex> lock(gSlabMutex);
+
+		if (cache.retired)
+			return CentralSlabAlloc(sizeClassIndex);
+
+		tCacheRetirer.armed = true;		// make sure the retirer gets constructed
+
+		for (int n = GetThreadCacheLimit(sizeClassIndex) / 2; n > 0; n--)
+		{
+			SlabFreeLink* link = (SlabFreeLink*) CentralSlabAlloc(sizeClassIndex);
+			link->next = cache.freeList[sizeClassIndex];
+			cache.freeList[sizeClassIndex] = link;
+			cache.count[sizeClassIndex]++;
+		}
+	}
+
+	SlabFreeLink* link = cache.freeList[sizeClassIndex];
+	cache.freeList[sizeClassIndex] = link->next;
+	cache.count[sizeClassIndex]--;
+	return (char*) link;
+}
+
+static void SlabFree(char* buf, int sizeClassIndex)
+{
+	ThreadCache& cache = tCache;
+
+	if (cache.retired)
+	{
+		std::lock_guard<std::mutex> lock(gSlabMutex);
+		CentralSlabFree(buf, sizeClassIndex);
+		return;
+	}
+
+	tCacheRetirer.armed = true;		// make sure the retirer gets constructed
+
+	SlabFreeLink* link = (SlabFreeLink*) buf;
+	link->next = cache.freeList[sizeClassIndex];
+	cache.freeList[sizeClassIndex] = link;
+	cache.count[sizeClassIndex]++;
+
+	// Cache overflowing: hand half of it back to the shared lists
+	const int limit = GetThreadCacheLimit(sizeClassIndex);
+	if (cache.count[sizeClassIndex] > limit)
+	{
+		std::lock_guard<std::mutex> lock(gSlabMutex);
+		while (cache.count[sizeClassIndex] > limit / 2)
+		{
+			link = cache.freeList[sizeClassIndex];
+			cache.freeList[sizeClassIndex] = link->next;
+			cache.count[sizeClassIndex]--;
+			CentralSlabFree((char*) link, sizeClassIndex);
+		}
+	}
+}
+
+#endif // POMME_SLAB_ALLOCATOR
+
+// Returns true if AllocRaw serves blocks of this size with fresh zero-filled pages.
+static bool IsPageMapped(size_t size)
+{
+#if POMME_PAGE_MAPPED_BLOCKS
+	return size >= PageAllocator::kMinBlockSize;
+#else
+	(void) size;
+	return false;
+#endif
+}
+
+// Returns the amount of bytes that AllocRaw will actually reserve for a request of the given size.
+static size_t RoundUpAllocSize(size_t size)
+{
+#if POMME_SLAB_ALLOCATOR
+	if (size <= kSlabMaxBlockSize)
+		return kSizeClassBytes[GetSizeClass(size)];
+#endif
+
+#if POMME_PAGE_MAPPED_BLOCKS
+	if (IsPageMapped(size))
+		return PageAllocator::RoundUp(size);
+#endif
+
+	return size;
+}
+
+static char* AllocRaw(size_t size)
+{
+#if POMME_SLAB_ALLOCATOR
+	if (size <= kSlabMaxBlockSize)
+		return SlabAlloc(GetSizeClass(size));
+#endif
+
+#if POMME_PAGE_MAPPED_BLOCKS
+	if (IsPageMapped(size))
+		return PageAllocator::Map(size);
+#endif
+
+	return new char[size];
+}
+
+static void FreeRaw(char* buf, size_t size)
+{
+#if POMME_SLAB_ALLOCATOR
+	if (size <= kSlabMaxBlockSize)
+	{
+		SlabFree(buf, GetSizeClass(size));
+		return;
+	}
+#endif
+
+#if POMME_PAGE_MAPPED_BLOCKS
+	if (IsPageMapped(size))
+	{
+		PageAllocator::Unmap(buf, size);
+		return;
+	}
+#else
+	(void) size;
+#endif
+
+	delete[] buf;
+}
+
+//-----------------------------------------------------------------------------
+// Aligned blocks
+//
+// Aligned blocks bypass the slab and zones. The raw buffer itself is aligned, so the
+// offset from the raw buffer to the payload can be derived from the alignment alone.
+
+static size_t RoundUpAlignedAllocSize(size_t size)
+{
+#if POMME_PAGE_MAPPED_BLOCKS
+	if (IsPageMapped(size))
+		return PageAllocator::RoundUp(size);
+#endif
+
+	return size;
+}
+
+static char* AllocAlignedRaw(size_t size, size_t alignment)
+{
+#if POMME_PAGE_MAPPED_BLOCKS
+	// Mappings are page-aligned, which satisfies any alignment up to kMaxAlignment
+	if (IsPageMapped(size))
+		return PageAllocator::Map(size);
+#endif
+
+	return (char*) ::operator new(size, std::align_val_t(alignment));
+}
 
+static void FreeAlignedRaw(char* buf, size_t size, size_t alignment)
+{
+#if POMME_PAGE_MAPPED_BLOCKS
+	if (IsPageMapped(size))
+	{
+		PageAllocator::Unmap(buf, size);
+		return;
+	}
+#endif
+
+	::operator delete(buf, std::align_val_t(alignment));
+}
+
+// Returns the alignment to pass to BlockDescriptor.
+// This is never 0, even if the default alignment would be enough, so that aligned blocks never come from a zone.
+static uint32_t ValidateAlignment(Size alignment)
+{
+	if (alignment <= 0 || (alignment & (alignment - 1)) != 0)
+		throw std::invalid_argument("alignment must be a power of two");
+	if (alignment > (Size) kMaxAlignment)
+		throw std::invalid_argument("alignment too large");
+
+	// A Ptr's descriptor sits right before its payload, in the slack at the start of the raw buffer
+	return (uint32_t) std::max<Size>(alignment, kBlockDescriptorPadding);
+}
+
+static_assert(kBlockDescriptorPadding <= kCacheLineSize);
+
+//-----------------------------------------------------------------------------
+// Zones
+//
+// While a zone is active on a thread, every Ptr and Handle that the thread allocates is
+// bump-allocated from large chunks owned by the zone. Disposing of a zone block doesn't give
+// its memory back; instead, popping the zone releases all of its blocks at once.
+
+static constexpr size_t kZoneChunkSize = 256 * 1024;
+static constexpr size_t kZoneAlignment = 16;
+
+struct Zone
+{
+	Zone* parent = nullptr;
+	std::vector<std::unique_ptr<char[]>> chunks;
+	char* cursor = nullptr;
+	char* end = nullptr;
+	std::vector<BlockDescriptor*> blocks;		// every block ever allocated in the zone, live or dead
+};
+
+static thread_local Zone* tCurrentZone = nullptr;
+
+static char* ZoneAlloc(Zone* zone, size_t& size)
+{
+	size = (size + kZoneAlignment - 1) & ~(kZoneAlignment - 1);
+
+	// Big blocks get a chunk of their own, so as not to waste the rest of the current chunk
+	if (size > kZoneChunkSize / 4)
+	{
+		zone->chunks.emplace_back(new char[size]);
+		return zone->chunks.back().get();
+	}
+
+	if (size > size_t(zone->end - zone->cursor))
+	{
+		zone->chunks.emplace_back(new char[kZoneChunkSize]);
+		zone->cursor = zone->chunks.back().get();
+		zone->end = zone->cursor + kZoneChunkSize;
+	}
+
+	char* buf = zone->cursor;
+	zone->cursor += size;
+	return buf;
+}
+
+//-----------------------------------------------------------------------------
+// Purgeable blocks
+//
+// Purgeable handles may lose their payload under memory pressure (PurgeMem/MaxMem).
+// Their master pointer then becomes nil; resource handles can be reloaded with LoadResource.
+// We also keep track of resource handles so they can be detached from their fork when it's closed.
+// gPurgeableMutex also guards the flags of handles and the swapping of their payloads,
+// since the purger and the compactor both look at them from whichever thread triggers them.
+
+static std::mutex gPurgeableMutex;
+static std::unordered_set<BlockDescriptor*> gPurgeableBlocks;
+static std::unordered_set<BlockDescriptor*> gResourceBlocks;
+
+//-----------------------------------------------------------------------------
+// Memory budget
+//
+// When an allocation would take the heap past the budget, eviction callbacks get a chance
+// to free up memory before the allocation goes through. The budget is soft: if the callbacks
+// can't free enough memory, the heap grows anyway.
+
+struct EvictionCallback
+{
+	long id;
+	int priority;
+	PommeEvictionProc proc;
+	void* userData;
+};
+
+static size_t PurgeBlocks(size_t bytesNeeded);
+
+// Static initialization runs on the main thread, before main()
+static const std::thread::id gMainThreadID = std::this_thread::get_id();
+
+static void PurgeEvictionProc(Size bytesNeeded, void*)
+{
+	// The app may dereference unlocked purgeable handles at any time on the main thread,
+	// so don't pull them out from under it. Allocations on other threads (e.g. the prefetch thread)
+	// just go over budget until the main thread's next allocation runs the callbacks again.
+	if (std::this_thread::get_id() != gMainThreadID)
+		return;
+
+	PurgeBlocks(bytesNeeded);
+}
+
+static std::atomic<size_t> gMemoryBudget = 0;
+static std::mutex gEvictionCallbacksMutex;
+static std::mutex gEvictionMutex;
+static long gNextEvictionCallbackID = 1;
+static std::vector<EvictionCallback> gEvictionCallbacks = { { 0, 0, PurgeEvictionProc, nullptr } };		// sorted by priority
+static thread_local bool tIsEvicting = false;
+
+static void RunEvictionCallbacks(size_t incomingBytes, size_t budget)
+{
+	// Only one thread evicts at a time; the others just go over budget for a bit
+	std::unique_lock<std::mutex> evictionLock(gEvictionMutex, std::try_to_lock);
+	if (!evictionLock.owns_lock())
+		return;
+
+	// Don't hold the lock while calling out, so that callbacks may (un)register callbacks
+	std::vector<EvictionCallback> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(gEvictionCallbacksMutex);
+		callbacks = gEvictionCallbacks;
+	}
+
+	// Callbacks may allocate or dispose of blocks; don't reenter the governor from them
+	tIsEvicting = true;
+
+	size_t projected = gTotalHeapSize.load(std::memory_order_relaxed) + incomingBytes;
+
+	for (const auto& callback : callbacks)
+	{
+		if (projected <= budget)
+			break;
+
+		callback.proc(Size(projected - budget), callback.userData);
+		projected = gTotalHeapSize.load(std::memory_order_relaxed) + incomingBytes;
+	}
+
+	tIsEvicting = false;
+
+	if (projected > budget)
+	{
+		LOG << "over budget by " << (projected - budget) << " bytes\n";
+	}
+}
+
+static inline void EnforceMemoryBudget(size_t incomingBytes)
+{
+	size_t budget = gMemoryBudget.load(std::memory_order_relaxed);
+
+	if (budget == 0 || tIsEvicting)
+		return;
+
+	if (gTotalHeapSize.load(std::memory_order_relaxed) + incomingBytes > budget)
+		RunEvictionCallbacks(incomingBytes, budget);
+}
+
+//-----------------------------------------------------------------------------
+// Internal buffers
+
+void* Pomme::Memory::AllocInternalBuffer(size_t size, size_t alignment, bool countTowardBudget)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > kMaxAlignment)
+		throw std::invalid_argument("alignment must be a power of two no larger than kMaxAlignment");
+
+	if (countTowardBudget)
+		EnforceMemoryBudget(size);
+
+	char* buffer = AllocAlignedRaw(RoundUpAlignedAllocSize(size), alignment);
+
+	if (countTowardBudget)
+		gTotalHeapSize.fetch_add(size, std::memory_order_relaxed);
+
+	return buffer;
+}
+
+void Pomme::Memory::FreeInternalBuffer(void* buffer, size_t size, size_t alignment, bool countTowardBudget)
+{
+	if (!buffer)
+		return;
+
+	FreeAlignedRaw((char*) buffer, RoundUpAlignedAllocSize(size), alignment);
+
+	if (countTowardBudget)
+		gTotalHeapSize.fetch_sub(size, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Implementation-specific stuff
+
+static void InitBlock(BlockDescriptor* block, uint32_t size, uint32_t capacity, uint32_t flags, Ptr data)
+{
 	block->magic = 'LIVE';
 	block->size = size;
-	block->ptrToData = buf + kBlockDescriptorPadding;
+	block->capacity = capacity;
+	block->flags = flags;
+	block->alignment = 0;
+	block->ptrToData = data;
 	block->rezMeta = nullptr;
+	block->tag = nullptr;
 
-	gTotalHeapSize += kBlockDescriptorPadding + size;
-	gNumBlocksAllocated++;
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnAlloc(block);
+#endif
+
+	gTotalHeapSize.fetch_add(kBlockDescriptorPadding + size, std::memory_order_relaxed);
+	gNumBlocksAllocated.fetch_add(1, std::memory_order_relaxed);
 
 #if POMME_PTR_TRACKING
-	block->ptrBatch = gCurrentPtrBatch;
-	block->ptrNumInBatch = gCurrentNumPtrsInBatch++;
-	gLivePtrNums.insert(block->ptrNumInBatch);
+	LiveBlockShard& shard = GetLiveBlockShard(block);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	block->ptrBatch = gCurrentPtrBatch.load(std::memory_order_relaxed);
+	block->ptrNumInBatch = gCurrentNumPtrsInBatch.fetch_add(1, std::memory_order_relaxed);
+	block->prevLive = nullptr;
+	block->nextLive = shard.head;
+	if (shard.head)
+		shard.head->prevLive = block;
+	shard.head = block;
+#else
+	block->prevLive = nullptr;
+	block->nextLive = nullptr;
 #endif
+}
+
+BlockDescriptor* BlockDescriptor::Allocate(uint32_t size, uint32_t alignment)
+{
+	EnforceMemoryBudget(kBlockDescriptorPadding + size);
+
+	if (alignment != 0)
+	{
+		// The payload sits `alignment` bytes into the raw buffer, right after the descriptor
+		size_t rawSize = RoundUpAlignedAllocSize(alignment + size);
+		char* buf = AllocAlignedRaw(rawSize, alignment);
+		uint32_t flags = IsPageMapped(rawSize) ? uint32_t(kBlockPageMapped) : 0;
 
+		BlockDescriptor* block = (BlockDescriptor*) (buf + alignment - kBlockDescriptorPadding);
+		InitBlock(block, size, uint32_t(rawSize - alignment), flags, buf + alignment);
+		block->alignment = (uint16_t) alignment;
+		return block;
+	}
+
+	if (Zone* zone = tCurrentZone)
+	{
+		size_t rawSize = kBlockDescriptorPadding + size;
+		char* buf = ZoneAlloc(zone, rawSize);
+
+		BlockDescriptor* block = (BlockDescriptor*) buf;
+		InitBlock(block, size, uint32_t(rawSize - kBlockDescriptorPadding), kBlockInZone, buf + kBlockDescriptorPadding);
+		zone->blocks.push_back(block);
+		return block;
+	}
+
+	size_t rawSize = RoundUpAllocSize(kBlockDescriptorPadding + size);
+	char* buf = AllocRaw(rawSize);
+	uint32_t flags = IsPageMapped(rawSize) ? uint32_t(kBlockPageMapped) : 0;
+
+	BlockDescriptor* block = (BlockDescriptor*) buf;
+	InitBlock(block, size, uint32_t(rawSize - kBlockDescriptorPadding), flags, buf + kBlockDescriptorPadding);
 	return block;
 }
 
-void BlockDescriptor::Free(BlockDescriptor* block)
+// Allocates the payload of a relocatable block and updates its capacity and flags.
+// Does not touch ptrToData.
+static Ptr AllocPayload(BlockDescriptor* block, size_t capacity)
 {
-	if (!block)
-		return;
+	if (block->alignment != 0)
+	{
+		capacity = RoundUpAlignedAllocSize(capacity);
+		block->capacity = (uint32_t) capacity;
+		block->flags &= ~(kBlockRelocatable | kBlockZonePayload | kBlockPageMapped | kBlockFileView);
+		if (IsPageMapped(capacity))
+			block->flags |= kBlockPageMapped;
+		return AllocAlignedRaw(capacity, block->alignment);
+	}
+
+#if POMME_RELOCATABLE_HANDLES
+	if (capacity <= RelocatableHeap::kMaxBlockSize)
+	{
+		Ptr data = RelocatableHeap::Alloc(block, capacity);
+		block->capacity = (uint32_t) capacity;
+		block->flags &= ~(kBlockZonePayload | kBlockPageMapped | kBlockFileView);
+		block->flags |= kBlockRelocatable;
+		return data;
+	}
+#endif
+
+	capacity = RoundUpAllocSize(capacity);
+	block->capacity = (uint32_t) capacity;
+	block->flags &= ~(kBlockRelocatable | kBlockZonePayload | kBlockPageMapped | kBlockFileView);
+	if (IsPageMapped(capacity))
+		block->flags |= kBlockPageMapped;
+	return AllocRaw(capacity);
+}
+
+static void FreePayload(uint32_t flags, uint32_t alignment, Ptr data, uint32_t capacity)
+{
+	if (!data)
+		return;		// purged handle
+	else if (alignment != 0)
+		FreeAlignedRaw(data, capacity, alignment);
+	else if (flags & kBlockZonePayload)
+		return;		// released along with the zone
+	else if (flags & kBlockFileView)
+		PageAllocator::UnmapFileView(data, capacity);
+	else if (flags & kBlockRelocatable)
+		RelocatableHeap::Free(data);
+	else
+		FreeRaw(data, capacity);
+}
+
+BlockDescriptor* BlockDescriptor::AllocateHandle(uint32_t size, uint32_t alignment)
+{
+	EnforceMemoryBudget(kBlockDescriptorPadding + size);
+
+	if (Zone* zone = tCurrentZone; zone && alignment == 0)
+	{
+		size_t descriptorSize = sizeof(BlockDescriptor);
+		size_t capacity = size;
+		BlockDescriptor* block = (BlockDescriptor*) ZoneAlloc(zone, descriptorSize);
+		Ptr data = ZoneAlloc(zone, capacity);
+
+		InitBlock(block, size, (uint32_t) capacity, kBlockIsHandle | kBlockInZone | kBlockZonePayload, data);
+		zone->blocks.push_back(block);
+		return block;
+	}
+
+	BlockDescriptor* block = (BlockDescriptor*) AllocRaw(sizeof(BlockDescriptor));
+	InitBlock(block, size, 0, kBlockIsHandle, nullptr);
+	block->alignment = (uint16_t) alignment;
+	block->ptrToData = AllocPayload(block, size);
+	return block;
+}
 
-	gTotalHeapSize -= kBlockDescriptorPadding + block->size;
-	gNumBlocksAllocated--;
+BlockDescriptor* BlockDescriptor::AllocateFileViewHandle(Ptr view, uint32_t size)
+{
+	EnforceMemoryBudget(kBlockDescriptorPadding + size);
+
+	BlockDescriptor* block = (BlockDescriptor*) AllocRaw(sizeof(BlockDescriptor));
+	InitBlock(block, size, size, kBlockIsHandle | kBlockFileView, view);
+	return block;
+}
+
+// Frees a block's payload and marks the block as dead, but doesn't free the descriptor itself.
+static void RetireBlock(BlockDescriptor* block)
+{
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnFree(block);
+#endif
+
+	gTotalHeapSize.fetch_sub(kBlockDescriptorPadding + block->size, std::memory_order_relaxed);
+	gNumBlocksAllocated.fetch_sub(1, std::memory_order_relaxed);
+
+	if ((block->flags & kBlockPurgeable) || block->rezMeta)
+	{
+		// Take the block out of the registry first so a concurrent PurgeMem can't free its payload twice
+		std::lock_guard<std::mutex> lock(gPurgeableMutex);
+		gPurgeableBlocks.erase(block);
+		gResourceBlocks.erase(block);
+	}
+
+	if (block->flags & kBlockIsHandle)
+		FreePayload(block->flags, block->alignment, block->ptrToData, block->capacity);
 
 	block->magic = 'DEAD';
 	block->size = 0;
 	block->ptrToData = nullptr;
 	block->rezMeta = nullptr;
 #if POMME_PTR_TRACKING
-	if (block->ptrBatch == gCurrentPtrBatch)
-		gLivePtrNums.erase(block->ptrNumInBatch);
+	{
+		LiveBlockShard& shard = GetLiveBlockShard(block);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (block->prevLive)
+			block->prevLive->nextLive = block->nextLive;
+		else
+			shard.head = block->nextLive;
+		if (block->nextLive)
+			block->nextLive->prevLive = block->prevLive;
+		block->prevLive = nullptr;
+		block->nextLive = nullptr;
+	}
 #endif
+}
 
-	char* buf = (char*) block;
-	delete[] buf;
+void BlockDescriptor::Free(BlockDescriptor* block)
+{
+	if (!block)
+		return;
+
+	const uint32_t capacity = block->capacity;
+	const uint32_t flags = block->flags;
+	const uint32_t alignment = block->alignment;
+
+	RetireBlock(block);
+	block->capacity = 0;
+
+	if (flags & kBlockInZone)
+		return;		// released along with the zone
+	else if (alignment != 0 && !(flags & kBlockIsHandle))
+		FreeAlignedRaw((char*) block + kBlockDescriptorPadding - alignment, alignment + capacity, alignment);
+	else if (flags & kBlockIsHandle)
+		FreeRaw((char*) block, sizeof(BlockDescriptor));
+	else
+		FreeRaw((char*) block, kBlockDescriptorPadding + capacity);
+}
+
+bool BlockDescriptor::Resize(uint32_t newSize)
+{
+	if (!(flags & kBlockIsHandle))
+		throw std::logic_error("can't resize a nonrelocatable block");
+
+	if (newSize > size)
+	{
+		// Keep the purger away from the block while making room for it.
+		// (This uses its own flag so that a concurrent HLock/HUnlock can't get lost.)
+		if (flags & kBlockPurgeable)
+		{
+			std::lock_guard<std::mutex> lock(gPurgeableMutex);
+			flags |= kBlockResizing;
+		}
+
+		EnforceMemoryBudget(newSize - size);
+	}
+
+	// Hold the lock until the payload has been swapped, so that the block can't be purged or
+	// compacted from under us, and so that its lock state can't change midway
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+	flags &= ~kBlockResizing;
+
+	if (newSize > capacity)
+	{
+		// Grow geometrically so that repeated appends are amortized O(1)
+		size_t newCapacity = std::max<size_t>(newSize, capacity + capacity / 2);
+		newCapacity = std::min<size_t>(newCapacity, 0x7FFFFFFF);
+
+		// A locked payload must stay put, so it may only grow in place
+		const bool mustStayPut = ptrToData && (flags & kBlockLocked);
+
+#if POMME_RELOCATABLE_HANDLES
+		size_t exactCapacity = newSize;
+		if ((flags & kBlockRelocatable) && RelocatableHeap::GrowInPlace(ptrToData, newCapacity))
+		{
+			capacity = (uint32_t) newCapacity;
+		}
+		else if (mustStayPut && (flags & kBlockRelocatable) && RelocatableHeap::GrowInPlace(ptrToData, exactCapacity))
+		{
+			capacity = (uint32_t) exactCapacity;
+		}
+		else
+#endif
+		if (mustStayPut)
+		{
+			LOG << "can't grow locked handle in place: " << capacity << " -> " << newSize << " bytes\n";
+			return false;
+		}
+		else
+		{
+			const uint32_t oldCapacity = capacity;
+			const uint32_t oldFlags = flags;
+			Ptr oldData = ptrToData;
+
+			// Note: if this is a zone handle, its payload leaves the zone; PopZone will still free it.
+			Ptr newData = AllocPayload(this, newCapacity);
+			if (oldData)
+				memcpy(newData, oldData, size);
+			FreePayload(oldFlags, alignment, oldData, oldCapacity);
+
+			LOG << "moved handle payload: " << oldCapacity << " -> " << capacity << " bytes\n";
+
+			// Only the master pointer changes, so existing Handles remain valid
+			ptrToData = newData;
+		}
+	}
+
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnResize(this, newSize);
+#endif
+
+	gTotalHeapSize.fetch_add(newSize, std::memory_order_relaxed);
+	gTotalHeapSize.fetch_sub(size, std::memory_order_relaxed);
+	size = newSize;
+	return true;
+}
+
+void BlockDescriptor::SetRezMeta(const Pomme::Files::ResourceMetadata* newRezMeta)
+{
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnSetRezMeta(this, newRezMeta);
+#endif
+
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+
+	if (newRezMeta)
+		gResourceBlocks.insert(this);
+	else
+		gResourceBlocks.erase(this);
+
+	rezMeta = newRezMeta;
+}
+
+void BlockDescriptor::SetPurgeable(bool purgeable)
+{
+	if (!(flags & kBlockIsHandle))
+		throw std::logic_error("can't make a nonrelocatable block purgeable");
+
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+
+	if (purgeable)
+	{
+		flags |= kBlockPurgeable;
+		gPurgeableBlocks.insert(this);
+	}
+	else
+	{
+		flags &= ~kBlockPurgeable;
+		gPurgeableBlocks.erase(this);
+	}
+}
+
+void BlockDescriptor::Empty()
+{
+	if (!(flags & kBlockIsHandle))
+		throw std::logic_error("can't empty a nonrelocatable block");
+
+	if (!ptrToData)
+		return;
+
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnResize(this, 0);
+#endif
+
+	gTotalHeapSize.fetch_sub(size, std::memory_order_relaxed);
+
+	FreePayload(flags, alignment, ptrToData, capacity);
+	ptrToData = nullptr;
+	size = 0;
+	capacity = 0;
+	flags &= ~(kBlockRelocatable | kBlockZonePayload | kBlockPageMapped | kBlockFileView);
+}
+
+void BlockDescriptor::AdoptFileView(Ptr view, uint32_t viewSize)
+{
+	if (!(flags & kBlockIsHandle))
+		throw std::logic_error("can't give a nonrelocatable block a new payload");
+
+	if (ptrToData || alignment != 0)
+		throw std::logic_error("block must be empty and unaligned to adopt a file view");
+
+	EnforceMemoryBudget(viewSize);
+
+#if POMME_ALLOC_PROFILING
+	AllocProfiler::OnResize(this, viewSize);
+#endif
+
+	gTotalHeapSize.fetch_add(viewSize, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+	ptrToData = view;
+	size = viewSize;
+	capacity = viewSize;
+	flags |= kBlockFileView;
+}
+
+std::vector<Handle> Pomme::Memory::GetResourceHandles(short forkRefNum)
+{
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+
+	std::vector<Handle> handles;
+
+	for (BlockDescriptor* block : gResourceBlocks)
+	{
+		if (block->rezMeta->forkRefNum == forkRefNum)
+			handles.push_back(&block->ptrToData);
+	}
+
+	return handles;
+}
+
+// Purges unlocked purgeable handles until at least `bytesNeeded` bytes have been freed.
+// Returns the amount of bytes freed.
+static size_t PurgeBlocks(size_t bytesNeeded)
+{
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+
+	size_t freed = 0;
+	size_t numPurged = 0;
+
+	for (BlockDescriptor* block : gPurgeableBlocks)
+	{
+		if (freed >= bytesNeeded)
+			break;
+
+		if (!block->ptrToData || (block->flags & (kBlockLocked | kBlockResizing)))
+			continue;
+
+		freed += block->size;
+		numPurged++;
+		block->Empty();
+	}
+
+	if (numPurged != 0)
+	{
+		LOG << "purged " << numPurged << " handles, " << freed << " bytes\n";
+	}
+
+	return freed;
 }
 
 void BlockDescriptor::CheckIsLive() const
@@ -80,9 +1002,10 @@ void BlockDescriptor::CheckIsLive() const
 
 BlockDescriptor* BlockDescriptor::HandleToBlock(Handle h)
 {
-	if (!h || !*h)
+	if (!h)
 		return nullptr;
-	BlockDescriptor* bd = (BlockDescriptor*) (*h - kBlockDescriptorPadding);
+	// A Handle points to the master pointer, which lives inside the block descriptor
+	BlockDescriptor* bd = (BlockDescriptor*) ((char*) h - offsetof(BlockDescriptor, ptrToData));
 	bd->CheckIsLive();
 	return bd;
 }
@@ -106,14 +1029,40 @@ Handle NewHandle(Size size)
 	if (size > 0x7FFFFFFF)
 		throw std::invalid_argument("trying to alloc massive handle");
 
-	BlockDescriptor* block = BlockDescriptor::Allocate((UInt32) size);
+	BlockDescriptor* block = BlockDescriptor::AllocateHandle((UInt32) size);
 	return &block->ptrToData;
 }
 
 Handle NewHandleClear(Size s)
 {
 	Handle h = NewHandle(s);
-	memset(*h, 0, s);
+
+	// Freshly-mapped pages are already zero-filled
+	if (!(BlockDescriptor::HandleToBlock(h)->flags & kBlockPageMapped))
+		memset(*h, 0, s);
+
+	return h;
+}
+
+Handle NewHandleAligned(Size size, Size alignment)
+{
+	if (size < 0)
+		throw std::invalid_argument("trying to alloc negative size handle");
+	if (size > 0x7FFFFFFF)
+		throw std::invalid_argument("trying to alloc massive handle");
+
+	BlockDescriptor* block = BlockDescriptor::AllocateHandle((UInt32) size, ValidateAlignment(alignment));
+	return &block->ptrToData;
+}
+
+Handle NewHandleClearAligned(Size s, Size alignment)
+{
+	Handle h = NewHandleAligned(s, alignment);
+
+	// Freshly-mapped pages are already zero-filled
+	if (!(BlockDescriptor::HandleToBlock(h)->flags & kBlockPageMapped))
+		memset(*h, 0, s);
+
 	return h;
 }
 
@@ -141,9 +1090,13 @@ Size GetHandleSize(Handle h)
 
 void SetHandleSize(Handle handle, Size byteCount)
 {
-	(void) handle;
-	(void) byteCount;
-	TODOFATAL();
+	if (byteCount < 0)
+		throw std::invalid_argument("trying to resize handle to negative size");
+	if (byteCount > 0x7FFFFFFF)
+		throw std::invalid_argument("trying to resize handle to massive size");
+
+	bool resized = BlockDescriptor::HandleToBlock(handle)->Resize((UInt32) byteCount);
+	tLastMemError = resized ? noErr : memFullErr;
 }
 
 void DisposeHandle(Handle h)
@@ -171,6 +1124,182 @@ OSErr PtrToHand(const void* srcPtr, Handle* dstHndl, Size size)
 	return noErr;
 }
 
+void HLock(Handle handle)
+{
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (block)
+	{
+		std::lock_guard<std::mutex> lock(gPurgeableMutex);
+		block->flags |= kBlockLocked;
+	}
+}
+
+void HLockHi(Handle handle)
+{
+	HLock(handle);
+}
+
+void HUnlock(Handle handle)
+{
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (block)
+	{
+		std::lock_guard<std::mutex> lock(gPurgeableMutex);
+		block->flags &= ~kBlockLocked;
+	}
+}
+
+void HPurge(Handle handle)
+{
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (block)
+		block->SetPurgeable(true);
+}
+
+void HNoPurge(Handle handle)
+{
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (block)
+		block->SetPurgeable(false);
+}
+
+void EmptyHandle(Handle handle)
+{
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+	if (!block)
+		return;
+
+	std::lock_guard<std::mutex> lock(gPurgeableMutex);
+
+	// Like the original Memory Manager, refuse to purge a locked block
+	if (block->flags & kBlockLocked)
+		return;
+
+	block->Empty();
+}
+
+void ReallocateHandle(Handle handle, Size byteCount)
+{
+	if (byteCount < 0)
+		throw std::invalid_argument("trying to reallocate handle to negative size");
+	if (byteCount > 0x7FFFFFFF)
+		throw std::invalid_argument("trying to reallocate handle to massive size");
+
+	BlockDescriptor* block = BlockDescriptor::HandleToBlock(handle);
+
+	bool isLocked;
+	{
+		std::lock_guard<std::mutex> lock(gPurgeableMutex);
+		isLocked = block->flags & kBlockLocked;
+	}
+
+	if (isLocked)
+		throw std::logic_error("can't reallocate a locked handle");
+
+	// The previous contents are discarded, so don't bother copying them over
+	EmptyHandle(handle);
+	bool resized = block->Resize((UInt32) byteCount);
+	tLastMemError = resized ? noErr : memFullErr;
+}
+
+OSErr MemError(void)
+{
+	return tLastMemError;
+}
+
+//-----------------------------------------------------------------------------
+// Memory: Heap compaction
+
+Size CompactMem(Size size)
+{
+#if POMME_RELOCATABLE_HANDLES
+	// Keep the lock state of handles steady while the compactor decides what it can move
+	std::unique_lock<std::mutex> lock(gPurgeableMutex);
+	size_t released = RelocatableHeap::Compact();
+	lock.unlock();
+	LOG << "released " << released << " bytes\n";
+#endif
+
+	// The heap grows on demand, so any block up to the requested size can be allocated
+	return size;
+}
+
+Size CompactMemSys(Size size)
+{
+	return CompactMem(size);
+}
+
+void PurgeMem(Size size)
+{
+	PurgeBlocks(size < 0 ? 0 : (size_t) size);
+}
+
+void PurgeMemSys(Size size)
+{
+	PurgeMem(size);
+}
+
+Size MaxMem(Size* grow)
+{
+	PurgeBlocks(SIZE_MAX);
+	CompactMem(maxSize);
+
+	// The heap grows on demand, so there's never any need to grow the zone
+	if (grow)
+		*grow = 0;
+
+	return maxSize;
+}
+
+//-----------------------------------------------------------------------------
+// Memory: budget
+
+void Pomme_SetMemoryBudget(Size bytes)
+{
+	if (bytes < 0)
+		throw std::invalid_argument("negative memory budget");
+
+	gMemoryBudget.store((size_t) bytes, std::memory_order_relaxed);
+
+	// Get under the new budget right away
+	EnforceMemoryBudget(0);
+}
+
+Size Pomme_GetMemoryBudget(void)
+{
+	return (Size) gMemoryBudget.load(std::memory_order_relaxed);
+}
+
+long Pomme_RegisterEvictionCallback(PommeEvictionProc proc, void* userData, int priority)
+{
+	if (!proc)
+		throw std::invalid_argument("null eviction callback");
+
+	std::lock_guard<std::mutex> lock(gEvictionCallbacksMutex);
+
+	EvictionCallback callback = { gNextEvictionCallbackID++, priority, proc, userData };
+
+	// Insert after callbacks of the same priority so that they run in registration order
+	auto it = std::upper_bound(gEvictionCallbacks.begin(), gEvictionCallbacks.end(), priority,
+		[](int p, const EvictionCallback& other) { return p < other.priority; });
+	gEvictionCallbacks.insert(it, callback);
+
+	return callback.id;
+}
+
+void Pomme_UnregisterEvictionCallback(long callbackID)
+{
+	std::lock_guard<std::mutex> lock(gEvictionCallbacksMutex);
+
+	auto it = std::find_if(gEvictionCallbacks.begin(), gEvictionCallbacks.end(),
+		[=](const EvictionCallback& callback) { return callback.id == callbackID; });
+
+	if (it == gEvictionCallbacks.end() || callbackID == 0)
+		throw std::invalid_argument("unknown eviction callback");
+
+	gEvictionCallbacks.erase(it);
+}
+
 //-----------------------------------------------------------------------------
 // Memory: Ptr
 
@@ -185,6 +1314,28 @@ Ptr NewPtr(Size byteCount)
 	return bd->ptrToData;
 }
 
+Ptr NewPtrAligned(Size byteCount, Size alignment)
+{
+	if (byteCount < 0)
+		throw std::invalid_argument("trying to NewPtr negative size");
+	if (byteCount > 0x7FFFFFFF)
+		throw std::invalid_argument("trying to alloc massive ptr");
+
+	BlockDescriptor* bd = BlockDescriptor::Allocate((UInt32) byteCount, ValidateAlignment(alignment));
+	return bd->ptrToData;
+}
+
+Ptr NewPtrClearAligned(Size byteCount, Size alignment)
+{
+	Ptr ptr = NewPtrAligned(byteCount, alignment);
+
+	// Freshly-mapped pages are already zero-filled
+	if (!(BlockDescriptor::PtrToBlock(ptr)->flags & kBlockPageMapped))
+		memset(ptr, 0, byteCount);
+
+	return ptr;
+}
+
 Ptr NewPtrSys(Size byteCount)
 {
 	return NewPtr(byteCount);
@@ -193,7 +1344,11 @@ Ptr NewPtrSys(Size byteCount)
 Ptr NewPtrClear(Size byteCount)
 {
 	Ptr ptr = NewPtr(byteCount);
-	memset(ptr, 0, byteCount);
+
+	// Freshly-mapped pages are already zero-filled
+	if (!(BlockDescriptor::PtrToBlock(ptr)->flags & kBlockPageMapped))
+		memset(ptr, 0, byteCount);
+
 	return ptr;
 }
 
@@ -213,31 +1368,92 @@ void DisposePtr(Ptr p)
 
 long Pomme_GetNumAllocs()
 {
-	return (long) gNumBlocksAllocated;
+	return (long) gNumBlocksAllocated.load(std::memory_order_relaxed);
 }
 
 Size Pomme_GetHeapSize()
 {
-	return (Size) gTotalHeapSize;
+	return (Size) gTotalHeapSize.load(std::memory_order_relaxed);
 }
 
 void Pomme_FlushPtrTracking(bool issueWarnings)
 {
 #if POMME_PTR_TRACKING
-	if (issueWarnings && !gLivePtrNums.empty())
+	auto locks = LockAllLiveBlockShards();
+
+	const uint32_t currentBatch = gCurrentPtrBatch.load(std::memory_order_relaxed);
+
+	if (issueWarnings)
 	{
-		for (uint32_t ptrNum : gLivePtrNums)
-			printf("%s: ptr/handle %d:%d is still live!\n", __func__, gCurrentPtrBatch, ptrNum);
+		for (const LiveBlockShard& shard : gLiveBlockShards)
+		{
+			for (const BlockDescriptor* block = shard.head; block; block = block->nextLive)
+			{
+				if (block->ptrBatch == currentBatch)
+					printf("%s: ptr/handle %d:%d is still live!\n", __func__, currentBatch, block->ptrNumInBatch);
+			}
+		}
 	}
 
-	gLivePtrNums.clear();
-	gCurrentPtrBatch++;
-	gCurrentNumPtrsInBatch = 0;
+	gCurrentPtrBatch.store(currentBatch + 1, std::memory_order_relaxed);
+	gCurrentNumPtrsInBatch.store(0, std::memory_order_relaxed);
 #else
 	(void) issueWarnings;
 #endif
 }
 
+void Pomme::Memory::ForEachLiveBlock(const std::function<void(const BlockDescriptor&)>& callback)
+{
+#if POMME_PTR_TRACKING
+	auto locks = LockAllLiveBlockShards();
+
+	for (const LiveBlockShard& shard : gLiveBlockShards)
+	{
+		for (const BlockDescriptor* block = shard.head; block; block = block->nextLive)
+			callback(*block);
+	}
+#else
+	(void) callback;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Memory: zones
+
+void Pomme_PushZone(void)
+{
+	Zone* zone = new Zone;
+	zone->parent = tCurrentZone;
+	tCurrentZone = zone;
+}
+
+void Pomme_PopZone(void)
+{
+	Zone* zone = tCurrentZone;
+
+	if (!zone)
+		throw std::logic_error("no zone to pop");
+
+	tCurrentZone = zone->parent;
+
+	// Retire blocks that the app didn't dispose of explicitly. This also frees the payloads
+	// of zone handles that were grown out of the zone, and takes the blocks out of
+	// pointer tracking so that they aren't reported as leaks.
+	size_t numReclaimed = 0;
+	for (BlockDescriptor* block : zone->blocks)
+	{
+		if (block->magic == 'LIVE')
+		{
+			RetireBlock(block);
+			numReclaimed++;
+		}
+	}
+
+	LOG << "reclaimed " << numReclaimed << " live blocks out of " << zone->blocks.size() << "\n";
+
+	delete zone;
+}
+
 //-----------------------------------------------------------------------------
 // Memory: BlockMove
 
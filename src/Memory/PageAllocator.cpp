@@ -0,0 +1,156 @@
+#include <cstdint>
+#include <new>
+
+#include "Memory/PageAllocator.h"
+
+#if _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+using namespace Pomme::Memory;
+
+static size_t QueryPageSize()
+{
+#if _WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return systemInfo.dwPageSize;
+#else
+	return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static const size_t gPageSize = QueryPageSize();
+
+size_t PageAllocator::RoundUp(size_t size)
+{
+	return (size + gPageSize - 1) & ~(gPageSize - 1);
+}
+
+char* PageAllocator::Map(size_t size)
+{
+#if _WIN32
+	void* pages = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!pages)
+		throw std::bad_alloc();
+#else
+	void* pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED)
+		throw std::bad_alloc();
+#endif
+
+	return (char*) pages;
+}
+
+void PageAllocator::Unmap(char* pages, size_t size)
+{
+#if _WIN32
+	(void) size;
+	VirtualFree(pages, 0, MEM_RELEASE);
+#else
+	munmap(pages, size);
+#endif
+}
+
+// Offsets of file views must be multiples of this.
+static size_t QueryFileViewGranularity()
+{
+#if _WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return systemInfo.dwAllocationGranularity;
+#else
+	return gPageSize;
+#endif
+}
+
+static const size_t gFileViewGranularity = QueryFileViewGranularity();
+
+intptr_t PageAllocator::OpenMappableFile(const fs::path& path, size_t& size)
+{
+	size = 0;
+
+#if _WIN32
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || uint64_t(fileSize.QuadPart) > SIZE_MAX)
+	{
+		CloseHandle(file);
+		return -1;
+	}
+
+	// The mapping object keeps the file alive on its own
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return -1;
+
+	size = (size_t) fileSize.QuadPart;
+	return (intptr_t) mapping;
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (0 != fstat(fd, &st) || st.st_size <= 0 || uint64_t(st.st_size) > SIZE_MAX)
+	{
+		close(fd);
+		return -1;
+	}
+
+	size = (size_t) st.st_size;
+	return fd;
+#endif
+}
+
+void PageAllocator::CloseMappableFile(intptr_t file)
+{
+#if _WIN32
+	CloseHandle((HANDLE) file);
+#else
+	close((int) file);
+#endif
+}
+
+char* PageAllocator::MapFileView(intptr_t file, uint64_t offset, size_t size)
+{
+	uint64_t viewOffset = offset & ~uint64_t(gFileViewGranularity - 1);
+	size_t slack = size_t(offset - viewOffset);
+
+#if _WIN32
+	void* view = MapViewOfFile((HANDLE) file, FILE_MAP_COPY, DWORD(viewOffset >> 32), DWORD(viewOffset), slack + size);
+	if (!view)
+		return nullptr;
+#else
+	void* view = mmap(nullptr, slack + size, PROT_READ | PROT_WRITE, MAP_PRIVATE, (int) file, (off_t) viewOffset);
+	if (view == MAP_FAILED)
+		return nullptr;
+#endif
+
+	return (char*) view + slack;
+}
+
+void PageAllocator::UnmapFileView(char* p, size_t size)
+{
+	char* view = (char*) (uintptr_t(p) & ~uintptr_t(gFileViewGranularity - 1));
+
+#if _WIN32
+	(void) size;
+	UnmapViewOfFile(view);
+#else
+	munmap(view, size_t(p - view) + size);
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CompilerSupport/filesystem.h"
+
+namespace Pomme::Memory::PageAllocator
+{
+	// Blocks at least this large get pages of their own, straight from the OS.
+	constexpr size_t kMinBlockSize = 256 * 1024;
+
+	// Rounds up a size to a whole number of pages.
+	size_t RoundUp(size_t size);
+
+	// Maps fresh anonymous pages. They're guaranteed to be zero-filled.
+	// `size` must have been rounded up with RoundUp.
+	char* Map(size_t size);
+
+	// Returns pages obtained from Map to the OS immediately.
+	void Unmap(char* pages, size_t size);
+
+	// Opens a file so that views of it can be mapped with MapFileView.
+	// Returns -1 if the file can't be opened or mapped (mapping an empty file isn't possible).
+	intptr_t OpenMappableFile(const fs::path& path, size_t& size);
+
+	// Closes a file opened with OpenMappableFile. Views of the file remain valid.
+	void CloseMappableFile(intptr_t file);
+
+	// Maps the pages spanning bytes [offset, offset+size) of a file, and returns a pointer to the byte at `offset`.
+	// The view is copy-on-write: its pages are writable, but writes never reach the file or any other view.
+	// Returns nullptr on failure.
+	char* MapFileView(intptr_t file, uint64_t offset, size_t size);
+
+	// Unmaps a view. `p` and `size` must be the same as in the call to MapFileView.
+	void UnmapFileView(char* p, size_t size);
+}
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Memory/RelocatableHeap.h"
+
+using namespace Pomme::Memory;
+using namespace Pomme::Memory::RelocatableHeap;
+
+#define LOG POMME_GENLOG(POMME_DEBUG_MEMORY, "RHEA")
+
+//-----------------------------------------------------------------------------
+// Relocatable heap
+//
+// Handle payloads are bump-allocated in large arenas. Each payload is preceded by a small
+// header pointing back to its BlockDescriptor. Disposing of a handle only marks its payload
+// as free; the space is reclaimed when Compact() slides the unlocked payloads of each arena
+// together (just like the classic Mac OS Memory Manager did) and gives empty arenas back to
+// the system. This keeps the heap's high-water mark bounded over long sessions.
+
+static constexpr size_t kArenaSize = 1024 * 1024;
+static constexpr size_t kAlignment = 16;
+
+struct HeapBlockHeader
+{
+	BlockDescriptor* owner;		// nullptr if the payload is free
+	uint32_t capacity;
+	uint32_t arenaIndex;
+};
+
+static constexpr size_t kHeaderSize = 16;
+static_assert(sizeof(HeapBlockHeader) <= kHeaderSize);
+static_assert(kMaxBlockSize + kHeaderSize <= kArenaSize);
+
+struct Arena
+{
+	std::unique_ptr<char[]> base;
+	size_t top = 0;				// bump cursor
+	size_t liveBytes = 0;		// bytes taken up by live payloads, headers included
+};
+
+static std::vector<std::unique_ptr<Arena>> gArenas;
+static std::mutex gArenasMutex;
+
+static HeapBlockHeader* GetHeader(Ptr payload)
+{
+	return (HeapBlockHeader*) (payload - kHeaderSize);
+}
+
+static size_t RoundUp(size_t size)
+{
+	size = std::max<size_t>(size, kAlignment);
+	return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+static Ptr BumpAlloc(uint32_t arenaIndex, BlockDescriptor* owner, size_t capacity)
+{
+	Arena& arena = *gArenas[arenaIndex];
+	const size_t blockBytes = kHeaderSize + capacity;
+
+	if (arena.top + blockBytes > kArenaSize)
+		return nullptr;
+
+	HeapBlockHeader* header = (HeapBlockHeader*) (arena.base.get() + arena.top);
+	header->owner = owner;
+	header->capacity = (uint32_t) capacity;
+	header->arenaIndex = arenaIndex;
+
+	arena.top += blockBytes;
+	arena.liveBytes += blockBytes;
+
+	return (Ptr) header + kHeaderSize;
+}
+
+Ptr RelocatableHeap::Alloc(BlockDescriptor* owner, size_t& capacity)
+{
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+
+	capacity = RoundUp(capacity);
+
+	if (capacity > kMaxBlockSize)
+		throw std::invalid_argument("block too large for relocatable heap");
+
+	// Most recent arenas are the likeliest to have room left
+	for (size_t i = gArenas.size(); i-- > 0; )
+	{
+		if (gArenas[i])
+		{
+			Ptr payload = BumpAlloc((uint32_t) i, owner, capacity);
+			if (payload)
+				return payload;
+		}
+	}
+
+	// Recycle an empty slot in the arena table, or append one
+	size_t slot = 0;
+	while (slot < gArenas.size() && gArenas[slot])
+		slot++;
+	if (slot == gArenas.size())
+		gArenas.emplace_back();
+
+	gArenas[slot] = std::make_unique<Arena>();
+	gArenas[slot]->base = std::make_unique<char[]>(kArenaSize);
+	LOG << "new arena #" << slot << "\n";
+
+	return BumpAlloc((uint32_t) slot, owner, capacity);
+}
+
+void RelocatableHeap::Free(Ptr payload)
+{
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+
+	HeapBlockHeader* header = GetHeader(payload);
+	Arena& arena = *gArenas.at(header->arenaIndex);
+
+	header->owner = nullptr;
+	arena.liveBytes -= kHeaderSize + header->capacity;
+
+	// Freeing the topmost payload gives its space back to the bump allocator right away
+	if ((char*) header + kHeaderSize + header->capacity == arena.base.get() + arena.top)
+		arena.top = (char*) header - arena.base.get();
+
+	if (arena.liveBytes == 0)
+	{
+		arena.top = 0;
+
+		// Keep the first arena around to avoid churn
+		if (header->arenaIndex != 0)
+		{
+			LOG << "released arena #" << header->arenaIndex << "\n";
+			gArenas[header->arenaIndex].reset();
+		}
+	}
+}
+
+bool RelocatableHeap::GrowInPlace(Ptr payload, size_t& capacity)
+{
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+
+	HeapBlockHeader* header = GetHeader(payload);
+	Arena& arena = *gArenas.at(header->arenaIndex);
+
+	const size_t newCapacity = RoundUp(capacity);
+
+	bool isTopmost = payload + header->capacity == arena.base.get() + arena.top;
+	if (!isTopmost || newCapacity > kMaxBlockSize || payload + newCapacity > arena.base.get() + kArenaSize)
+		return false;
+
+	arena.top += newCapacity - header->capacity;
+	arena.liveBytes += newCapacity - header->capacity;
+	header->capacity = (uint32_t) newCapacity;
+	capacity = newCapacity;
+	return true;
+}
+
+static void MovePayload(HeapBlockHeader* header, char* destination, uint32_t destinationArenaIndex)
+{
+	const size_t blockBytes = kHeaderSize + header->capacity;
+	memmove(destination, header, blockBytes);
+
+	HeapBlockHeader* moved = (HeapBlockHeader*) destination;
+	moved->arenaIndex = destinationArenaIndex;
+	moved->owner->ptrToData = destination + kHeaderSize;
+}
+
+// Slides unlocked payloads toward the bottom of the arena.
+// Returns true if the arena contains locked payloads.
+static bool SlideArena(uint32_t arenaIndex)
+{
+	Arena& arena = *gArenas[arenaIndex];
+	char* base = arena.base.get();
+
+	size_t src = 0;
+	size_t dst = 0;
+	bool hasLockedBlocks = false;
+
+	while (src < arena.top)
+	{
+		HeapBlockHeader* header = (HeapBlockHeader*) (base + src);
+		const size_t blockBytes = kHeaderSize + header->capacity;
+
+		if (!header->owner)
+		{
+			src += blockBytes;
+		}
+		else if (header->owner->flags & kBlockLocked)
+		{
+			// Locked payloads can't move; mark the gap in front of them as a free block
+			if (dst != src)
+			{
+				HeapBlockHeader* gap = (HeapBlockHeader*) (base + dst);
+				gap->owner = nullptr;
+				gap->capacity = uint32_t(src - dst - kHeaderSize);
+				gap->arenaIndex = arenaIndex;
+			}
+			hasLockedBlocks = true;
+			src += blockBytes;
+			dst = src;
+		}
+		else
+		{
+			if (dst != src)
+				MovePayload(header, base + dst, arenaIndex);
+			src += blockBytes;
+			dst += blockBytes;
+		}
+	}
+
+	arena.top = dst;
+	return hasLockedBlocks;
+}
+
+// Tries to move all payloads in an arena to the free space at the top of lower arenas.
+static void EvacuateArena(uint32_t arenaIndex)
+{
+	Arena& arena = *gArenas[arenaIndex];
+	char* base = arena.base.get();
+
+	size_t pos = 0;
+	while (pos < arena.top)
+	{
+		HeapBlockHeader* header = (HeapBlockHeader*) (base + pos);
+		const size_t blockBytes = kHeaderSize + header->capacity;
+
+		for (uint32_t i = 0; header->owner && i < arenaIndex; i++)
+		{
+			Arena* other = gArenas[i].get();
+			if (other && other->top + blockBytes <= kArenaSize)
+			{
+				MovePayload(header, other->base.get() + other->top, i);
+				other->top += blockBytes;
+				other->liveBytes += blockBytes;
+				arena.liveBytes -= blockBytes;
+				header->owner = nullptr;
+			}
+		}
+
+		pos += blockBytes;
+	}
+}
+
+size_t RelocatableHeap::Compact()
+{
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+
+	size_t released = 0;
+
+	for (uint32_t i = 0; i < gArenas.size(); i++)
+	{
+		if (!gArenas[i])
+			continue;
+
+		bool hasLockedBlocks = SlideArena(i);
+
+		// Sparse arenas are worth emptying out entirely
+		if (!hasLockedBlocks && i != 0 && gArenas[i]->liveBytes < kArenaSize / 4)
+		{
+			EvacuateArena(i);
+			SlideArena(i);
+		}
+
+		if (gArenas[i]->liveBytes == 0 && i != 0)
+		{
+			gArenas[i].reset();
+			released += kArenaSize;
+			LOG << "released arena #" << i << "\n";
+		}
+	}
+
+	while (!gArenas.empty() && !gArenas.back())
+		gArenas.pop_back();
+
+	return released;
+}
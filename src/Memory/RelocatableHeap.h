@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Pomme.h"
+#include "PommeMemory.h"
+
+namespace Pomme::Memory::RelocatableHeap
+{
+	// Handle payloads larger than this get their own allocation outside the relocatable heap.
+	constexpr size_t kMaxBlockSize = 256 * 1024;
+
+	// Carves out a payload for the given block, and rounds up `capacity` to the amount actually reserved.
+	// Never moves other blocks.
+	Ptr Alloc(BlockDescriptor* owner, size_t& capacity);
+
+	void Free(Ptr payload);
+
+	// Extends the payload in place if nothing lies after it in its arena.
+	bool GrowInPlace(Ptr payload, size_t& capacity);
+
+	// Slides unlocked payloads together and returns emptied arenas to the system.
+	// Patches the master pointers of all moved blocks.
+	// Returns the amount of bytes released.
+	size_t Compact();
+}
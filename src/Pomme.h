@@ -81,6 +81,30 @@ OSErr DirCreate(short vRefNum, long parentDirID, const char* cstrDirectoryName,
 
 OSErr GetVol(char* outVolNameC, short* vRefNum);
 
+// Pomme extension:
+// Mounts an archive made with Pomme_PackArchive as a read-only volume.
+// The new volume's reference number is stored in vRefNum; pass it to FSMakeFSSpec to access the archive's files.
+OSErr Pomme_MountArchive(const char* hostPath, short* vRefNum);
+
+// Pomme extension:
+// Packs the contents of a host directory into an archive that can be mounted with Pomme_MountArchive.
+// AppleDouble files named "Foo.rsrc" become the resource fork of "Foo".
+// If `compress` is true, forks that compress well are stored compressed with a built-in LZ codec.
+OSErr Pomme_PackArchive(const char* sourceDirectory, const char* archivePath, Boolean compress);
+
+// Pomme extension:
+// Mounts an empty read-only volume whose files live in memory. Add files to it with Pomme_AddMemoryFile.
+// The new volume's reference number is stored in vRefNum; pass it to FSMakeFSSpec to access its files.
+OSErr Pomme_MountMemoryVolume(short* vRefNum);
+
+// Pomme extension:
+// Adds a file to a volume mounted with Pomme_MountMemoryVolume, at a colon-separated path
+// relative to the volume's root (e.g. "Models:Level1.3dmf"). Intermediate directories are created as needed.
+// Pass NULL for a fork that the file doesn't have. Resource forks are raw, without an AppleDouble header.
+// The buffers aren't copied: they must stay alive and unchanged for as long as the application runs.
+// Returns bdNamErr if the path is illegal, or dupFNErr if it's already taken.
+OSErr Pomme_AddMemoryFile(short vRefNum, const char* path, const void* dataFork, long dataForkSize, const void* resourceFork, long resourceForkSize);
+
 //-----------------------------------------------------------------------------
 // File I/O
 
@@ -132,6 +156,10 @@ Handle Get1IndResource(ResType theType, short index);
 
 void GetResInfo(Handle theResource, short* theID, ResType* theType, char* name256);
 
+// Reads a resource's data back into its handle if it has been purged (see Pomme_SetPurgeableResources).
+// The handle may be locked.
+void LoadResource(Handle theResource);
+
 void ReleaseResource(Handle theResource);
 
 void RemoveResource(Handle theResource);
@@ -148,6 +176,38 @@ long GetResourceSizeOnDisk(Handle);
 
 long SizeResource(Handle);
 
+// Pomme extension:
+// Gets several resources at once, as if by calling GetResource on each of them.
+// n is the number of entries in `types` and `ids`; the handles are stored in `outHandles`,
+// which must have room for n entries. Resources that can't be found get a nil handle, and ResError returns resNotFound.
+// The resources are read in the order in which they're laid out on disk, with neighboring resources read in one go.
+// If any of them can't be read (e.g. it's corrupt, or memory runs out), all handles are nil,
+// and ResError returns ioErr or memFullErr.
+void Pomme_GetResources(const ResType* types, const short* ids, int n, Handle* outHandles);
+
+// Pomme extension:
+// Starts loading the given resources on a background thread. n is the number of entries in `types` and `ids`.
+// Each resource is looked up right away, in the same way as GetResource. Resources that can't be found are skipped.
+// Once a resource has been loaded, the next GetResource call for it returns the preloaded data without touching the disk.
+// If GetResource asks for a resource that's still waiting in the queue, it's read right away and its prefetch is dropped.
+// Preloaded data that hasn't been claimed yet is dropped when its resource file is closed,
+// or when the heap exceeds the memory budget (see Pomme_SetMemoryBudget).
+void Pomme_PrefetchResources(const ResType* types, const short* ids, int n);
+
+// Pomme extension:
+// Enables a persistent cache of parsed resource maps, stored in the given host directory (created if needed).
+// Resource files whose size and modification time haven't changed since their map was cached are opened without parsing.
+// Pass NULL to disable the cache (the default).
+void Pomme_SetResourceMapCacheDirectory(const char* hostPath);
+
+// Pomme extension:
+// Controls whether resources marked purgeable (resPurgeable) in their resource file are loaded into purgeable handles.
+// PurgeMem, MaxMem and the memory budget may then free them, leaving a nil master pointer
+// until LoadResource is called on the handle. Only enable this if the app calls LoadResource
+// before using a resource that may have been purged, as it had to on the original Memory Manager.
+// Only affects resources loaded afterwards. Off by default.
+void Pomme_SetPurgeableResources(Boolean enable);
+
 //-----------------------------------------------------------------------------
 // QuickDraw 2D: Errors
 
@@ -354,35 +414,6 @@ static inline void MaxApplZone(void) {}
 // No-op in Pomme.
 static inline void MoreMasters(void) {}
 
-// No-op in Pomme.
-static inline Size CompactMem(Size size) { return size; }
-
-// No-op in Pomme.
-// Compact system heap zone manually.
-static inline Size CompactMemSys(Size size) { return size; }
-
-// No-op in Pomme.
-static inline void PurgeMem(Size size) { (void) size; }
-
-// No-op in Pomme.
-static inline void PurgeMemSys(Size size) { (void) size; }
-
-// No-op in Pomme.
-// TODO: do something about `grow` and return a large integer to make it look like we have tons of memory.
-static inline Size MaxMem(Size* grow) { (void) grow; return 0; }
-
-// No-op in Pomme.
-static inline void HNoPurge(Handle handle) { (void) handle; }	// no-op
-
-// No-op in Pomme.
-static inline void HLock(Handle handle) { (void) handle; }	// no-op
-
-// No-op in Pomme.
-static inline void HLockHi(Handle handle) { (void) handle; }	// no-op
-
-// No-op in Pomme.
-static inline void HUnlock(Handle handle) { (void) handle; }	// no-op
-
 // No-op in Pomme.
 static inline void NoPurgePixels(PixMapHandle handle) { (void) handle; }	// no-op
 
@@ -398,12 +429,22 @@ static inline Ptr StripAddress(Ptr ptr) { return ptr; }  // no-op
 
 //-----------------------------------------------------------------------------
 // Memory: Handle
+// (Ptr and Handle allocation routines are safe to call from any thread.)
 
 Handle NewHandle(Size);
 
 // Allocate prezeroed memory
 Handle NewHandleClear(Size);
 
+// Pomme extension:
+// Allocates a handle whose payload is aligned to the given power of two (up to 4096 bytes),
+// e.g. 64 for cache-line alignment. The payload keeps its alignment if the handle is resized.
+// Aligned blocks are never allocated from a zone.
+Handle NewHandleAligned(Size, Size alignment);
+
+// Pomme extension:
+Handle NewHandleClearAligned(Size, Size alignment);
+
 Handle NewHandleSys(Size);
 
 Handle NewHandleSysClear(Size);
@@ -413,19 +454,108 @@ Handle TempNewHandle(Size, OSErr*);
 
 Size GetHandleSize(Handle);
 
-// Change the logical size of the relocatable block corresponding to a handle
+// Change the logical size of the relocatable block corresponding to a handle.
+// A locked handle's payload never moves: if it can't grow in place, the handle is left as is
+// and MemError returns memFullErr.
 void SetHandleSize(Handle, Size);
 
+// Returns the result of the last SetHandleSize or ReallocateHandle call on this thread.
+OSErr MemError(void);
+
 void DisposeHandle(Handle);
 
+// Prevents a handle's payload from moving during heap compaction.
+void HLock(Handle);
+
+// Same as HLock in Pomme (there's no point in moving the block to the top of the heap first).
+void HLockHi(Handle);
+
+// Lets a handle's payload move during heap compaction again.
+void HUnlock(Handle);
+
+// Marks a handle as purgeable: PurgeMem/MaxMem may then free its payload and set its master pointer to nil.
+// Purged resource handles can be reloaded with LoadResource.
+void HPurge(Handle);
+
+void HNoPurge(Handle);
+
+// Frees a handle's payload and sets its master pointer to nil. The handle itself remains valid.
+// Does nothing if the handle is locked.
+void EmptyHandle(Handle);
+
+// Allocates a new payload for a handle (typically, one that was emptied or purged).
+// The previous contents are lost.
+void ReallocateHandle(Handle, Size);
+
+//-----------------------------------------------------------------------------
+// Memory: Heap compaction
+
+// Slides unlocked relocatable blocks together and returns unused memory to the system.
+// Only has an effect if Pomme is built with POMME_RELOCATABLE_HANDLES.
+// Call this at an idle point (e.g. between levels), while no dereferenced unlocked handle is held.
+Size CompactMem(Size size);
+
+// Same as CompactMem in Pomme (there's a single heap).
+Size CompactMemSys(Size size);
+
+// Purges unlocked purgeable handles until at least `size` bytes have been freed.
+// Pass maxSize to purge all of them.
+void PurgeMem(Size size);
+
+// Same as PurgeMem in Pomme (there's a single heap).
+void PurgeMemSys(Size size);
+
+// Purges all unlocked purgeable handles and compacts the heap.
+// Since the heap grows on demand, returns maxSize and sets `grow` to 0.
+Size MaxMem(Size* grow);
+
 // Allocates a handle of the given size and copies the contents of srcPtr into it
 OSErr PtrToHand(const void* srcPtr, Handle* dstHndl, Size size);
 
+//-----------------------------------------------------------------------------
+// Memory: budget
+
+// Pomme extension:
+// Called when an allocation would take the heap past the memory budget.
+// `bytesNeeded` is how much the heap exceeds the budget by. The callback should free up
+// as much of that as it can (e.g. by disposing of caches), and may itself allocate memory.
+typedef void (*PommeEvictionProc)(Size bytesNeeded, void* userData);
+
+// Pomme extension:
+// Sets a soft limit on the heap size (as reported by Pomme_GetHeapSize). Pass 0 for no limit (the default).
+// Allocations that would exceed the budget first run the eviction callbacks; if they can't
+// free up enough memory, the allocation goes through anyway.
+void Pomme_SetMemoryBudget(Size bytes);
+
+// Pomme extension:
+Size Pomme_GetMemoryBudget(void);
+
+// Pomme extension:
+// Registers a callback that frees up memory when the heap exceeds the budget.
+// Callbacks run in ascending priority order until the heap is back under budget.
+// Pomme releases idle decoder scratch memory at priority -1, purges purgeable handles at priority 0
+// (only when the allocation happens on the main thread),
+// and drops unclaimed prefetched resources (see Pomme_PrefetchResources) at priority 1.
+// Returns an ID for Pomme_UnregisterEvictionCallback.
+long Pomme_RegisterEvictionCallback(PommeEvictionProc proc, void* userData, int priority);
+
+// Pomme extension:
+// Note that a callback may still be running on another thread when this returns.
+void Pomme_UnregisterEvictionCallback(long callbackID);
+
 //-----------------------------------------------------------------------------
 // Memory: Ptr
 
 Ptr NewPtr(Size);
 
+// Pomme extension:
+// Allocates a Ptr aligned to the given power of two (up to 4096 bytes), e.g. 64 for cache-line alignment.
+// Aligned blocks are never allocated from a zone.
+Ptr NewPtrAligned(Size, Size alignment);
+
+// Pomme extension:
+Ptr NewPtrClearAligned(Size, Size alignment);
+
 Ptr NewPtrSys(Size);
 
 Ptr NewPtrClear(Size);
@@ -445,11 +575,57 @@ long Pomme_GetNumAllocs(void);
 // Returns lower bound of total heap allocated by application
 Size Pomme_GetHeapSize(void);
 
+//-----------------------------------------------------------------------------
+// Memory: zones
+
+// Pomme extension:
+// Starts a zone on the calling thread. Until the zone is popped, every Ptr and Handle
+// that the thread allocates is bump-allocated from large chunks owned by the zone.
+// Zones may be nested.
+void Pomme_PushZone(void);
+
+// Pomme extension:
+// Ends the calling thread's innermost zone and releases all of its Ptrs and Handles at once,
+// including those that haven't been disposed of. They must not be used afterwards.
+void Pomme_PopZone(void);
+
+// Pomme extension:
+// Sets the tag that the allocation profiler attributes the calling thread's subsequent
+// Ptr/Handle allocations to. The string must outlive the allocations. Pass NULL to clear the tag.
+// Returns the previous tag.
+const char* Pomme_SetAllocTag(const char* tag);
+
+// Pomme extension:
+// Prints live bytes, live blocks, allocation counts and allocation rates per size class,
+// per allocation tag, and per resource type.
+// Requires building Pomme with POMME_ALLOC_PROFILING.
+void Pomme_DumpAllocProfile(void);
+
 //-----------------------------------------------------------------------------
 // Memory: pointer tracking
 
 void Pomme_FlushPtrTracking(bool issueWarnings);
 
+typedef struct PommeHeapSnapshot PommeHeapSnapshot;
+
+// Pomme extension:
+// Records all live Ptrs and Handles, e.g. at a level transition, for Pomme_DumpHeapDiff.
+// Requires building Pomme with POMME_PTR_TRACKING.
+PommeHeapSnapshot* Pomme_HeapSnapshot(void);
+
+// Pomme extension:
+void Pomme_DisposeHeapSnapshot(PommeHeapSnapshot* snapshot);
+
+// Pomme extension:
+// Prints the live blocks in a snapshot, grouped by size class, by resource type/ID,
+// and by pointer tracking batch.
+void Pomme_DumpHeapSnapshot(const PommeHeapSnapshot* snapshot);
+
+// Pomme extension:
+// Prints which blocks were allocated (live in `after` only), retained (live in both)
+// or freed (live in `before` only) between two snapshots, with the same grouping as above.
+void Pomme_DumpHeapDiff(const PommeHeapSnapshot* before, const PommeHeapSnapshot* after);
+
 //-----------------------------------------------------------------------------
 // Memory: BlockMove
 
@@ -209,6 +209,17 @@ enum EResTypes
     rAliasType = 'alis',
 };
 
+// Resource attributes
+enum EResAttributes
+{
+    resSysHeap      = 64,   // load resource into the system heap
+    resPurgeable    = 32,   // resource handle is purgeable
+    resLocked       = 16,   // resource handle is locked
+    resProtected    = 8,    // resource can't be changed
+    resPreload      = 4,    // load resource when its file is opened
+    resChanged      = 2,    // resource has been changed
+};
+
 //-----------------------------------------------------------------------------
 // Sound Manager enums
 
@@ -3,9 +3,25 @@
 #include "PommeTypes.h"
 
 #include <iostream>
-#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
 #include "CompilerSupport/filesystem.h"
 
+// Open read-only forks on the host volume by mapping them into memory rather than through std::fstream.
+#if !defined(POMME_MAPPED_FORKS)
+	#define POMME_MAPPED_FORKS	1
+#endif
+
+// Let GetResource hand out large resources from mapped forks without copying them.
+// The Handle's payload is then a private copy-on-write view of the file's pages,
+// so the app may still modify it freely. Off by default because each such resource
+// costs a mapping (and on Windows, up to 64 KB of address space of slack).
+#if !defined(POMME_MAPPED_RESOURCES)
+	#define POMME_MAPPED_RESOURCES	0
+#endif
+
 namespace Pomme::Files
 {
 	struct ResourceMetadata
@@ -14,15 +30,37 @@ namespace Pomme::Files
 		OSType			type;
 		SInt16			id;
 		Byte			flags;
-		SInt32			size;
+		mutable SInt32	size;		// -1 until the resource is first accessed (the size is stored in the data section)
 		std::streamoff	dataOffset;
 		std::string		name;
 	};
 
 	struct ResourceFork
 	{
+		struct TypeRange
+		{
+			ResType type;
+			UInt32 first;		// index of the type's first resource in `resources`
+			UInt32 count;
+		};
+
 		SInt16 fileRefNum;
-		std::map<ResType, std::map<SInt16, ResourceMetadata> > resourceMap;
+
+		// The fork's stream and mapped bytes (see GetStream and GetMappedBytes), kept at hand
+		// so that the prefetch thread never needs to go through the table of open files.
+		std::iostream* stream;
+		std::span<char> mappedBytes;
+
+		// Serializes access to the stream, and to resource sizes (which are looked up lazily),
+		// between the main thread and the prefetch thread.
+		std::mutex streamMutex;
+
+		// Every resource in the fork, grouped by type and sorted by ID within each type.
+		// Left alone once the fork is open, because resource Handles point to their metadata.
+		std::vector<ResourceMetadata> resources;
+
+		// Types present in the fork, sorted by type.
+		std::vector<TypeRange> types;
 	};
 
 	void Init();
@@ -35,6 +73,17 @@ namespace Pomme::Files
 
 	std::iostream& GetStream(short refNum);
 
+	// If the fork's entire contents are in memory (e.g. it's memory-mapped), returns them; stream positions index into this span.
+	// Returns an empty span otherwise.
+	std::span<char> GetMappedBytes(short refNum);
+
+	// Maps a private copy-on-write view of part of a memory-mapped fork (see PageAllocator::MapFileView).
+	// Returns nullptr if the fork isn't mapped.
+	char* MapForkView(short refNum, std::streamoff offset, size_t size);
+
+	// Returns the path of the host file backing the fork, or an empty path if the fork doesn't live on the host filesystem.
+	fs::path GetHostPath(short refNum);
+
 	const FSSpec& GetSpec(short refNum);
 
 	void CloseStream(short refNum);
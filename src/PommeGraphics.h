@@ -1,6 +1,7 @@
 #pragma once
 
 #include "PommeTypes.h"
+#include "PommeMemory.h"
 #include <istream>
 #include <vector>
 
@@ -21,7 +22,7 @@ namespace Pomme::Graphics
 	{
 		int width;
 		int height;
-		std::vector<Byte> data;
+		Pomme::Memory::AlignedVector<Byte> data;		// cache-line aligned for vectorized blitting
 
 		ARGBPixmap();
 
@@ -1,9 +1,43 @@
 #pragma once
 
+#include <functional>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Pomme.h"
+
+// Keep track of live Ptrs/Handles to detect leaks (see Pomme_FlushPtrTracking).
+// This costs O(1) per allocation, so it's cheap enough to leave on in release builds.
 #if !defined(POMME_PTR_TRACKING)
 	#define POMME_PTR_TRACKING		_DEBUG
 #endif
 
+// Serve small Ptrs/Handles from per-size-class free lists in large pages
+#if !defined(POMME_SLAB_ALLOCATOR)
+	#define POMME_SLAB_ALLOCATOR	1
+#endif
+
+// Give large blocks pages of their own, straight from the OS (mmap/VirtualAlloc),
+// so that freeing them returns memory to the OS right away.
+// Such pages arrive zero-filled, so NewPtrClear/NewHandleClear don't need to clear them.
+#if !defined(POMME_PAGE_MAPPED_BLOCKS)
+	#define POMME_PAGE_MAPPED_BLOCKS	1
+#endif
+
+// Keep Handle payloads in a heap that CompactMem can defragment.
+// Off by default: unlocked handles may then move, so the app must HLock any handle
+// whose payload it holds a raw pointer into across a call to CompactMem.
+#if !defined(POMME_RELOCATABLE_HANDLES)
+	#define POMME_RELOCATABLE_HANDLES	0
+#endif
+
+// Keep per-size-class, per-tag and per-resource-type allocation statistics
+#if !defined(POMME_ALLOC_PROFILING)
+	#define POMME_ALLOC_PROFILING	0
+#endif
+
 namespace Pomme::Files
 {
 	struct ResourceMetadata;
@@ -11,19 +45,74 @@ namespace Pomme::Files
 
 namespace Pomme::Memory
 {
+	constexpr size_t kCacheLineSize = 64;
+
+	// Largest alignment supported by NewPtrAligned/NewHandleAligned.
+	constexpr size_t kMaxAlignment = 4096;
+
+	enum BlockFlags : uint16_t
+	{
+		kBlockIsHandle			= 1 << 0,	// payload lives apart from the descriptor; ptrToData is the master pointer
+		kBlockLocked			= 1 << 1,	// HLock: payload must not move during heap compaction
+		kBlockRelocatable		= 1 << 2,	// payload lives in the compactable heap
+		kBlockInZone			= 1 << 3,	// descriptor (and payload, if it's a Ptr) belongs to a zone
+		kBlockZonePayload		= 1 << 4,	// handle payload belongs to a zone
+		kBlockPurgeable			= 1 << 5,	// HPurge: payload may be freed under memory pressure
+		kBlockPageMapped		= 1 << 6,	// payload was freshly mapped from the OS, so it started out zero-filled
+		kBlockFileView			= 1 << 7,	// handle payload is a private view of a file (see PageAllocator::MapFileView)
+		kBlockResizing			= 1 << 8,	// Resize is making room for the block, so it must not be purged
+	};
+
+	// A Ptr's descriptor is padded to 64 bytes and sits right before its payload.
+	// The raw buffers come from new[] or the slab allocator, so by default payloads are only
+	// aligned to alignof(std::max_align_t); use NewPtrAligned/NewHandleAligned for cache-line alignment.
 	struct BlockDescriptor
 	{
 		uint32_t magic;
 		uint32_t size;
+		uint32_t capacity;
+		uint16_t flags;
+		uint16_t alignment;		// 0 unless allocated with NewPtrAligned/NewHandleAligned
 		uint32_t ptrBatch;
 		uint32_t ptrNumInBatch;
 		Ptr ptrToData;
 		const Pomme::Files::ResourceMetadata* rezMeta;
+		const char* tag;		// allocation tag (see Pomme_SetAllocTag), only set with POMME_ALLOC_PROFILING
+		BlockDescriptor* prevLive;	// intrusive list of live blocks, only maintained with POMME_PTR_TRACKING
+		BlockDescriptor* nextLive;
 
-		static BlockDescriptor* Allocate(uint32_t size);
+		// Allocates a nonrelocatable block: the payload directly follows the descriptor.
+		// If `alignment` is nonzero, it must be a power of two between 64 and kMaxAlignment.
+		static BlockDescriptor* Allocate(uint32_t size, uint32_t alignment = 0);
+
+		// Allocates a relocatable block: the descriptor acts as the master pointer,
+		// and the payload is stored separately so it can move without invalidating the Handle.
+		// If `alignment` is nonzero, the payload keeps that alignment when it moves.
+		static BlockDescriptor* AllocateHandle(uint32_t size, uint32_t alignment = 0);
+
+		// Allocates a relocatable block whose payload is a view returned by PageAllocator::MapFileView.
+		// The block takes ownership of the view. The payload moves out of the view if the block grows.
+		static BlockDescriptor* AllocateFileViewHandle(Ptr view, uint32_t size);
 
 		static void Free(BlockDescriptor* block);
 
+		// Changes the logical size of a relocatable block.
+		// Growth happens in place if there's spare capacity; otherwise, the payload
+		// is moved to a larger buffer and the master pointer is patched.
+		// Returns false (leaving the block untouched) if the block is locked and can't grow in place.
+		bool Resize(uint32_t newSize);
+
+		void SetRezMeta(const Pomme::Files::ResourceMetadata* newRezMeta);
+
+		void SetPurgeable(bool purgeable);
+
+		// Frees the payload of a relocatable block and sets its master pointer to nil.
+		void Empty();
+
+		// Gives an empty relocatable block a view returned by PageAllocator::MapFileView as its payload.
+		// The block takes ownership of the view.
+		void AdoptFileView(Ptr view, uint32_t size);
+
 		void CheckIsLive() const;
 
 		static BlockDescriptor* HandleToBlock(Handle h);
@@ -31,6 +120,145 @@ namespace Pomme::Memory
 		static BlockDescriptor* PtrToBlock(Ptr p);
 	};
 
+	// Calls `callback` on every live block, in no particular order, while holding the pointer tracking locks.
+	// The callback must not allocate or dispose of Ptrs/Handles.
+	// Does nothing unless Pomme is built with POMME_PTR_TRACKING.
+	void ForEachLiveBlock(const std::function<void(const BlockDescriptor&)>& callback);
+
+	// Returns all live handles whose rezMeta points into the given resource fork.
+	std::vector<Handle> GetResourceHandles(short forkRefNum);
+
+	struct HeapSnapshotBlock
+	{
+		uint32_t batch;				// pointer tracking ID
+		uint32_t numInBatch;
+		uint32_t size;
+		bool isResource;
+		ResType rezType;
+		SInt16 rezID;
+	};
+
+	struct HeapDiffEntry
+	{
+		std::string name;
+		size_t addedBlocks;			// live in the newer snapshot only
+		size_t addedBytes;
+		size_t retainedBlocks;		// live in both snapshots
+		size_t retainedBytes;
+		size_t freedBlocks;			// live in the older snapshot only
+		size_t freedBytes;
+	};
+
+	struct HeapDiff
+	{
+		std::vector<HeapDiffEntry> bySizeClass;
+		std::vector<HeapDiffEntry> byResource;
+		std::vector<HeapDiffEntry> byBatch;		// pointer tracking batch (see Pomme_FlushPtrTracking)
+	};
+}
+
+// Opaque in C (see Pomme_HeapSnapshot)
+struct PommeHeapSnapshot
+{
+	std::vector<Pomme::Memory::HeapSnapshotBlock> blocks;	// sorted by tracking ID
+};
+
+namespace Pomme::Memory
+{
+	// Records all live blocks. Empty unless Pomme is built with POMME_PTR_TRACKING.
+	PommeHeapSnapshot TakeHeapSnapshot();
+
+	// Groups blocks by size class, by resource and by tracking batch, sorted by added bytes.
+	HeapDiff DiffHeapSnapshots(const PommeHeapSnapshot& before, const PommeHeapSnapshot& after);
+
+	struct AllocProfileEntry
+	{
+		std::string name;
+		size_t liveBytes;
+		size_t liveBlocks;
+		uint64_t totalAllocs;
+		double allocsPerSecond;		// since the previous call to GetAllocProfile
+	};
+
+	struct AllocProfile
+	{
+		std::vector<AllocProfileEntry> bySizeClass;
+		std::vector<AllocProfileEntry> byTag;
+		std::vector<AllocProfileEntry> byResourceType;
+	};
+
+	// Returns allocation statistics, sorted by live bytes.
+	// Empty unless Pomme is built with POMME_ALLOC_PROFILING.
+	AllocProfile GetAllocProfile();
+
+	// Tags all Ptrs/Handles allocated by the current thread within the current scope.
+	class AllocTagScope
+	{
+	public:
+		AllocTagScope(const char* tag)
+			: previousTag(Pomme_SetAllocTag(tag))
+		{}
+
+		~AllocTagScope()
+		{
+			Pomme_SetAllocTag(previousTag);
+		}
+
+	private:
+		const char* previousTag;
+	};
+
+	#define POMME_ALLOC_TAG_CONCAT2(a, b) a##b
+	#define POMME_ALLOC_TAG_CONCAT(a, b) POMME_ALLOC_TAG_CONCAT2(a, b)
+	#define POMME_ALLOC_TAG(tag) Pomme::Memory::AllocTagScope POMME_ALLOC_TAG_CONCAT(pommeAllocTag, __LINE__)(tag)
+
+	// Allocates an aligned buffer for Pomme's own use. Unlike NewPtrAligned, such buffers are
+	// invisible to the app: they bypass zones and pointer tracking, so they're never reported as leaks.
+	// If `countTowardBudget` is false, they're also left out of the heap size and the memory budget.
+	// `alignment` must be a power of two no larger than kMaxAlignment.
+	// Free the buffer with FreeInternalBuffer, passing the same size, alignment and `countTowardBudget`.
+	void* AllocInternalBuffer(size_t size, size_t alignment, bool countTowardBudget = false);
+
+	void FreeInternalBuffer(void* buffer, size_t size, size_t alignment, bool countTowardBudget = false);
+
+	// STL allocator for Pomme's internal buffers that benefit from aligned vector loads, e.g. pixels and samples.
+	// Allocations don't count as Ptrs (see AllocInternalBuffer).
+	template<typename T, size_t Alignment = kCacheLineSize>
+	struct AlignedAllocator
+	{
+		using value_type = T;
+
+		template<typename U>
+		struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+		AlignedAllocator() noexcept = default;
+
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+		T* allocate(size_t n)
+		{
+			if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+				throw std::bad_alloc();
+
+			return (T*) AllocInternalBuffer(n * sizeof(T), Alignment);
+		}
+
+		void deallocate(T* p, size_t n) noexcept
+		{
+			FreeInternalBuffer(p, n * sizeof(T), Alignment);
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+	};
+
+	template<typename T>
+	using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
 	class DisposeHandleGuard
 	{
 	public:
@@ -51,7 +51,8 @@ private:
 //-----------------------------------------------------------------------------
 // Memory allocator
 
-#define ALLOCATOR_HEADER_BYTES 16
+// A full cache line, so that payloads (pixmaps, vertex arrays...) are cache-line aligned
+#define ALLOCATOR_HEADER_BYTES 64
 
 struct __Q3AllocatorCookie
 {
@@ -66,7 +67,7 @@ static T* __Q3Alloc(size_t count, uint32_t classID)
 {
 	size_t totalBytes = ALLOCATOR_HEADER_BYTES + count*sizeof(T);
 
-	uint8_t* block = (uint8_t*) calloc(totalBytes, 1);
+	uint8_t* block = (uint8_t*) NewPtrClearAligned(totalBytes, ALLOCATOR_HEADER_BYTES);
 
 	__Q3AllocatorCookie* cookie = (__Q3AllocatorCookie*) block;
 
@@ -102,7 +103,7 @@ static void __Q3Dispose(void* object, uint32_t classID)
 
 	cookie->classID = 'DEAD';
 
-	free(cookie);
+	DisposePtr((Ptr) cookie);
 }
 
 template<typename T>
@@ -146,7 +147,8 @@ static T* __Q3Copy(const T* sourcePayload, uint32_t classID)
 
 	__Q3AllocatorCookie* sourceCookie = __Q3GetCookie(sourcePayload, classID);
 
-	uint8_t* block = (uint8_t*) calloc(sourceCookie->blockSize, 1);
+	// Copy the cookie along with the payload
+	uint8_t* block = (uint8_t*) NewPtrAligned(sourceCookie->blockSize, ALLOCATOR_HEADER_BYTES);
 	memcpy(block, sourceCookie, sourceCookie->blockSize);
 
 	return (T*) (block + ALLOCATOR_HEADER_BYTES);
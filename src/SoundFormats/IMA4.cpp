@@ -19,8 +19,8 @@
  */
 
 #include "PommeSound.h"
+#include "Utilities/ScratchArena.h"
 
-#include <vector>
 #include <cassert>
 #include <algorithm>
 
@@ -85,7 +85,7 @@ static inline int adpcm_ima_qt_expand_nibble(ADPCMChannelStatus* c, int nibble)
 static void DecodeIMA4Chunk(
 	const uint8_t** input,
 	int16_t** output,
-	std::vector<ADPCMChannelStatus>& ctx)
+	std::span<ADPCMChannelStatus> ctx)
 {
 	const size_t nChannels = ctx.size();
 	const unsigned char* in = *input;
@@ -149,7 +149,8 @@ void Pomme::Sound::IMA4::Decode(
 
 	const uint8_t* in = reinterpret_cast<const unsigned char*>(input.data());
 	int16_t* out = reinterpret_cast<int16_t*>(output.data());
-	std::vector<ADPCMChannelStatus> ctx(nChannels);
+	Pomme::ScratchScope scratch;
+	std::span<ADPCMChannelStatus> ctx(scratch.AllocArrayClear<ADPCMChannelStatus>(nChannels), nChannels);
 
 	for (size_t chunk = 0; chunk < nChunks; chunk++)
 	{
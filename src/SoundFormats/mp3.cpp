@@ -1,9 +1,9 @@
 #ifndef POMME_NO_MP3
 
 #include "PommeSound.h"
+#include "Utilities/ScratchArena.h"
 
-#include <vector>
-#include <algorithm>
+#include <cstring>
 
 #define MINIMP3_IMPLEMENTATION
 #include "SoundFormats/minimp3.h"
@@ -18,49 +18,54 @@ SndListHandle Pomme::Sound::LoadMP3AsResource(std::istream& stream)
 
 	mp3dec_frame_info_t frameInfo = {};
 
-	std::vector<uint8_t> fileBuf;
-	std::vector<mp3d_sample_t> songPCM;
-	std::vector<mp3d_sample_t> tempPCM(MINIMP3_MAX_SAMPLES_PER_FRAME);
+	// All intermediate buffers come from the scratch arena; MakeStandaloneResource copies the PCM data out.
+	Pomme::ScratchScope scratch;
+
+	uint8_t* fileBuf = scratch.AllocArray<uint8_t>(MINIMP3_BUF_SIZE);
+	size_t fileBufSize = 0;
+
+	// Allocated last so that it can keep growing in place
+	mp3d_sample_t* songPCM = nullptr;
+	size_t songPCMSize = 0;
+	size_t songPCMCapacity = 0;
 
 	int totalSamples = 0;
 
-	while (!stream.eof() || !fileBuf.empty())
+	while (!stream.eof() || fileBufSize != 0)
 	{
 		// Refill the buffer as long as data is available in the input stream.
 		// Once the stream is depleted, keep feeding the buffer to mp3dec until the buffer is empty.
-		if (fileBuf.size() < MINIMP3_BUF_SIZE
+		if (fileBufSize < MINIMP3_BUF_SIZE
 			&& !stream.eof())
 		{
-			auto oldSize = fileBuf.size();
-			auto toRead = MINIMP3_BUF_SIZE - oldSize;
-
-			fileBuf.resize(MINIMP3_BUF_SIZE);
-			stream.read((char*) (fileBuf.data() + oldSize), (int) toRead);
-
-			auto didRead = stream.gcount();
-			fileBuf.resize(oldSize + didRead);
+			auto toRead = MINIMP3_BUF_SIZE - fileBufSize;
+			stream.read((char*) (fileBuf + fileBufSize), (int) toRead);
+			fileBufSize += stream.gcount();
 		}
 
-		if (fileBuf.empty())
+		if (fileBufSize == 0)
 		{
 			break;
 		}
 
-		int numDecodedSamples = mp3dec_decode_frame(&context, fileBuf.data(), (int) fileBuf.size(), tempPCM.data(), &frameInfo);
+		// Make room for a full frame at the end of the song, and decode straight into it
+		if (songPCMCapacity < songPCMSize + MINIMP3_MAX_SAMPLES_PER_FRAME)
+		{
+			size_t newCapacity = 2 * (songPCMSize + MINIMP3_MAX_SAMPLES_PER_FRAME);
+			songPCM = scratch.GrowArray(songPCM, songPCMCapacity, newCapacity);
+			songPCMCapacity = newCapacity;
+		}
+
+		int numDecodedSamples = mp3dec_decode_frame(&context, fileBuf, (int) fileBufSize, songPCM + songPCMSize, &frameInfo);
 
 		if (numDecodedSamples > 0)
 		{
-			size_t minCapacity = songPCM.size() + (numDecodedSamples * frameInfo.channels);
-			if (songPCM.capacity() < minCapacity)
-			{
-				songPCM.reserve(2 * minCapacity);
-			}
-
-			songPCM.insert(songPCM.end(), tempPCM.begin(), tempPCM.begin() + (numDecodedSamples * frameInfo.channels));
+			songPCMSize += numDecodedSamples * frameInfo.channels;
 			totalSamples += numDecodedSamples;
 		}
 
-		fileBuf.erase(fileBuf.begin(), fileBuf.begin() + frameInfo.frame_bytes);
+		fileBufSize -= frameInfo.frame_bytes;
+		memmove(fileBuf, fileBuf + frameInfo.frame_bytes, fileBufSize);
 	}
 
 	Pomme::Sound::SampledSoundInfo info = {};
@@ -79,7 +84,7 @@ SndListHandle Pomme::Sound::LoadMP3AsResource(std::istream& stream)
 	info.nPackets			= totalSamples;
 	info.decompressedLength	= totalSamples * info.nChannels * sizeof(mp3d_sample_t);
 	info.compressedLength	= info.decompressedLength;
-	info.dataStart			= (char*) songPCM.data();
+	info.dataStart			= (char*) songPCM;
 	return info.MakeStandaloneResource();
 }
 
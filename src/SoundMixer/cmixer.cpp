@@ -574,7 +574,7 @@ std::span<char> WavStream::GetBuffer(int nBytesOut)
 	return std::span(userBuffer.data(), nBytesOut);
 }
 
-std::span<char> WavStream::SetBuffer(std::vector<char>&& data)
+std::span<char> WavStream::SetBuffer(Pomme::Memory::AlignedVector<char>&& data)
 {
 	userBuffer = std::move(data);
 	return std::span(userBuffer.data(), userBuffer.size());
@@ -28,6 +28,7 @@
 #include <functional>
 #include <cstdint>
 #include "CompilerSupport/span.h"
+#include "PommeMemory.h"
 
 #define BUFFER_SIZE (512)
 
@@ -100,7 +101,7 @@ namespace cmixer
 		bool bigEndian;
 		int idx;
 		std::span<char> span;
-		std::vector<char> userBuffer;
+		Pomme::Memory::AlignedVector<char> userBuffer;
 
 		void ClearImplementation() override;
 		void RewindImplementation() override;
@@ -113,7 +114,7 @@ namespace cmixer
 		WavStream();
 		void Init(int theSampleRate, int theBitDepth, int nChannels, bool bigEndian, std::span<char> data);
 		std::span<char> GetBuffer(int nBytesOut);
-		std::span<char> SetBuffer(std::vector<char>&& data);
+		std::span<char> SetBuffer(Pomme::Memory::AlignedVector<char>&& data);
 	};
 
 	// Guard class that safely removes the source from the mixer when the guard object is destroyed.
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <deque>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace Pomme
+{
+
+	// Pool of objects addressed by small integer IDs (e.g. file refNums).
+	//
+	// Objects live in fixed-size chunks that are never moved or freed, so pointers and
+	// references to live objects remain valid as the pool grows.
+	//
+	// The low INDEX_BITS of an ID select a slot; the remaining (non-sign) bits hold the slot's
+	// generation, which is bumped every time the slot is disposed of. A stale ID that refers
+	// to a slot that has since been reused is therefore rejected in O(1).
+	// Freed slots are recycled in FIFO order so that generations wrap around as late as possible.
+	//
+	// The first ID handed out by a fresh pool is always 0.
+	template<typename TObj, typename TId, int INDEX_BITS, int CHUNK_SIZE = 64>
+	class ChunkedPool
+	{
+		static constexpr int kGenerationBits = std::numeric_limits<TId>::digits - INDEX_BITS;
+		static constexpr unsigned kMaxSlots = 1u << INDEX_BITS;
+		static constexpr unsigned kIndexMask = kMaxSlots - 1;
+		static constexpr unsigned kGenerationMask = (1u << kGenerationBits) - 1;
+
+		static_assert(kGenerationBits >= 1, "not enough bits left for generations");
+		static_assert(kMaxSlots % CHUNK_SIZE == 0, "chunk size must divide slot count");
+
+		struct Chunk
+		{
+			TObj objects[CHUNK_SIZE];
+			unsigned generations[CHUNK_SIZE] = {};
+			bool isInUse[CHUNK_SIZE] = {};
+		};
+
+		std::vector<std::unique_ptr<Chunk>> chunks;
+		std::deque<unsigned> freeSlots;
+		unsigned inUse, inUsePeak;
+
+		static unsigned GetSlot(TId id)
+		{
+			return unsigned(id) & kIndexMask;
+		}
+
+		TId MakeID(unsigned slot) const
+		{
+			unsigned generation = chunks[slot / CHUNK_SIZE]->generations[slot % CHUNK_SIZE];
+			return TId((generation << INDEX_BITS) | slot);
+		}
+
+	public:
+		ChunkedPool()
+		{
+			inUse = 0;
+			inUsePeak = 0;
+		}
+
+		TId Alloc()
+		{
+			if (IsFull()) throw std::length_error("too many items allocated");
+
+			if (freeSlots.empty())
+			{
+				// Grow by one chunk; existing objects stay put
+				unsigned firstSlot = unsigned(chunks.size()) * CHUNK_SIZE;
+				chunks.push_back(std::make_unique<Chunk>());
+				for (unsigned i = 0; i < CHUNK_SIZE; i++)
+					freeSlots.push_back(firstSlot + i);
+			}
+
+			unsigned slot = freeSlots.front();
+			freeSlots.pop_front();
+			chunks[slot / CHUNK_SIZE]->isInUse[slot % CHUNK_SIZE] = true;
+
+			inUse++;
+			if (inUse > inUsePeak)
+			{
+				inUsePeak = inUse;
+			}
+
+			return MakeID(slot);
+		}
+
+		void Dispose(TId id)
+		{
+			if (!IsAllocated(id)) throw std::invalid_argument("id isn't allocated");
+
+			unsigned slot = GetSlot(id);
+			Chunk& chunk = *chunks[slot / CHUNK_SIZE];
+			chunk.objects[slot % CHUNK_SIZE] = TObj();
+			chunk.isInUse[slot % CHUNK_SIZE] = false;
+			chunk.generations[slot % CHUNK_SIZE] = (chunk.generations[slot % CHUNK_SIZE] + 1) & kGenerationMask;
+
+			freeSlots.push_back(slot);
+			inUse--;
+		}
+
+		TObj& operator[](TId id)
+		{
+			if (!IsAllocated(id)) throw std::invalid_argument("id isn't allocated");
+			unsigned slot = GetSlot(id);
+			return chunks[slot / CHUNK_SIZE]->objects[slot % CHUNK_SIZE];
+		}
+
+		const TObj& operator[](TId id) const
+		{
+			if (!IsAllocated(id)) throw std::invalid_argument("id isn't allocated");
+			unsigned slot = GetSlot(id);
+			return chunks[slot / CHUNK_SIZE]->objects[slot % CHUNK_SIZE];
+		}
+
+		bool IsFull() const
+		{
+			return inUse >= kMaxSlots;
+		}
+
+		bool IsAllocated(TId id) const
+		{
+			if (id < 0 || (unsigned(id) >> INDEX_BITS) > kGenerationMask)
+				return false;
+
+			unsigned slot = GetSlot(id);
+			if (slot / CHUNK_SIZE >= chunks.size())
+				return false;
+
+			const Chunk& chunk = *chunks[slot / CHUNK_SIZE];
+			return chunk.isInUse[slot % CHUNK_SIZE]
+				&& chunk.generations[slot % CHUNK_SIZE] == (unsigned(id) >> INDEX_BITS);
+		}
+
+		// Calls `callback(id, object)` on every live slot, in slot order.
+		template<typename F>
+		void ForEach(F callback)
+		{
+			for (size_t c = 0; c < chunks.size(); c++)
+			{
+				for (unsigned i = 0; i < CHUNK_SIZE; i++)
+				{
+					if (chunks[c]->isInUse[i])
+						callback(MakeID(unsigned(c * CHUNK_SIZE + i)), chunks[c]->objects[i]);
+				}
+			}
+		}
+
+		unsigned GetNumInUse() const
+		{
+			return inUse;
+		}
+	};
+
+}
@@ -0,0 +1,206 @@
+#include "Utilities/LZ.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kMaxOffset = 65535;
+static constexpr int kHashBits = 16;
+static constexpr size_t kLastLiterals = 5;		// LZ4: the last 5 bytes of a block are always literals
+static constexpr size_t kMatchStartMargin = 12;	// LZ4: the last match starts at least 12 bytes before the end
+
+static uint32_t Read32(const char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t Hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+// Most recent position of each hashed 4-byte sequence. The table is reused by every Compress call
+// on the thread. Rather than being cleared, each call numbers its positions from where the previous
+// one left off, so entries left over from earlier calls (those at or below `base`) read as empty.
+struct HashTable
+{
+	std::vector<uint32_t> slots = std::vector<uint32_t>(size_t(1) << kHashBits, 0);
+	uint32_t base = 0;
+};
+
+static HashTable& GetHashTableForCurrentThread(size_t size)
+{
+	thread_local HashTable table;
+
+	// Start over once the numbering would overflow
+	if (size_t(std::numeric_limits<uint32_t>::max() - table.base) <= size)
+	{
+		std::fill(table.slots.begin(), table.slots.end(), 0);
+		table.base = 0;
+	}
+
+	return table;
+}
+
+static void WriteLength(std::vector<char>& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back(char(255));
+		length -= 255;
+	}
+	out.push_back(char(length));
+}
+
+static void WriteSequence(std::vector<char>& out, const char* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength ? matchLength - kMinMatch : 0;
+
+	out.push_back(char((std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(matchCode, 15)));
+
+	if (numLiterals >= 15)
+		WriteLength(out, numLiterals - 15);
+
+	out.insert(out.end(), literals, literals + numLiterals);
+
+	if (matchLength)
+	{
+		out.push_back(char(offset & 0xFF));
+		out.push_back(char(offset >> 8));
+
+		if (matchCode >= 15)
+			WriteLength(out, matchCode - 15);
+	}
+}
+
+std::vector<char> Pomme::LZ::Compress(std::span<const char> src)
+{
+	std::vector<char> out;
+	out.reserve(src.size() / 2 + 16);
+
+	const char* data = src.data();
+	const size_t size = src.size();
+
+	HashTable& table = GetHashTableForCurrentThread(size);
+	const uint32_t base = table.base;
+
+	size_t anchor = 0;		// start of pending literals
+	size_t pos = 0;
+
+	// Blocks that are too short for the end-of-block rules to allow any match are all literals
+	const size_t matchStartLimit = size > kMatchStartMargin ? size - kMatchStartMargin : 0;
+	const size_t matchEndLimit = size - kLastLiterals;
+
+	while (pos < matchStartLimit)
+	{
+		uint32_t sequence = Read32(data + pos);
+		uint32_t& slot = table.slots[Hash(sequence)];
+		size_t candidate = slot > base ? slot - base : 0;		// position + 1, or 0 if none
+		slot = uint32_t(base + pos + 1);
+
+		if (candidate == 0 || pos - (candidate - 1) > kMaxOffset || Read32(data + candidate - 1) != sequence)
+		{
+			// Skip ahead faster through data that doesn't compress
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+
+		size_t matchPos = candidate - 1;
+		size_t matchLength = kMinMatch;
+		while (pos + matchLength < matchEndLimit && data[matchPos + matchLength] == data[pos + matchLength])
+			matchLength++;
+
+		WriteSequence(out, data + anchor, pos - anchor, pos - matchPos, matchLength);
+
+		pos += matchLength;
+		anchor = pos;
+	}
+
+	WriteSequence(out, data + anchor, size - anchor, 0, 0);
+
+	table.base = uint32_t(base + size);
+	return out;
+}
+
+void Pomme::LZ::Decompress(std::span<const char> src, std::span<char> dst)
+{
+	const auto* in = reinterpret_cast<const uint8_t*>(src.data());
+	const auto* inEnd = in + src.size();
+	char* out = dst.data();
+	char* outEnd = out + dst.size();
+
+	auto ReadLength = [&](size_t length) -> size_t
+	{
+		if (length == 15)
+		{
+			uint8_t b;
+			do
+			{
+				if (in == inEnd)
+					throw std::runtime_error("LZ: truncated length");
+				b = *in++;
+				length += b;
+			} while (b == 255);
+		}
+		return length;
+	};
+
+	while (true)
+	{
+		if (in == inEnd)
+			throw std::runtime_error("LZ: truncated block");
+
+		uint8_t token = *in++;
+
+		size_t numLiterals = ReadLength(token >> 4);
+		if (numLiterals > size_t(inEnd - in) || numLiterals > size_t(outEnd - out))
+			throw std::runtime_error("LZ: literals out of bounds");
+
+		memcpy(out, in, numLiterals);
+		in += numLiterals;
+		out += numLiterals;
+
+		// The last sequence has no match
+		if (in == inEnd)
+			break;
+
+		if (inEnd - in < 2)
+			throw std::runtime_error("LZ: truncated offset");
+
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t matchLength = ReadLength(token & 15) + kMinMatch;
+
+		if (offset == 0 || offset > size_t(out - dst.data()) || matchLength > size_t(outEnd - out))
+			throw std::runtime_error("LZ: match out of bounds");
+
+		// The match may overlap the output it's copying. Copy it in chunks no larger than the offset,
+		// so that every chunk has been written out in full before it's read back.
+		const char* match = out - offset;
+		char* matchEnd = out + matchLength;
+
+		if (offset >= 16)
+		{
+			for (; matchEnd - out >= 16; out += 16, match += 16)
+				memcpy(out, match, 16);
+		}
+
+		if (offset >= 8)
+		{
+			for (; matchEnd - out >= 8; out += 8, match += 8)
+				memcpy(out, match, 8);
+		}
+
+		while (out != matchEnd)
+			*out++ = *match++;
+	}
+
+	if (out != outEnd)
+		throw std::runtime_error("LZ: decompressed size mismatch");
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+namespace Pomme::LZ
+{
+	// Fast byte-oriented LZ77 codec, using the LZ4 block format.
+	//
+	// A block is a series of sequences. Each sequence starts with a token byte: its high nibble
+	// is the number of literals, its low nibble is the match length minus 4 (a nibble of 15 means
+	// that the count continues in subsequent bytes, which are added up until one isn't 255).
+	// The literals come next, followed by the match offset (2 bytes, little-endian) and the rest
+	// of the match length. The last sequence only has literals.
+	//
+	// Compress also follows LZ4's end-of-block rules, so that its output can be decoded by any
+	// LZ4 block decoder: the last 5 bytes are always literals, and the last match starts
+	// at least 12 bytes before the end of the block.
+
+	std::vector<char> Compress(std::span<const char> src);
+
+	// `dst` must be exactly as large as the uncompressed data.
+	// Throws std::runtime_error if the block is malformed or doesn't decompress to exactly `dst.size()` bytes.
+	void Decompress(std::span<const char> src, std::span<char> dst);
+}
@@ -0,0 +1,197 @@
+#include "Utilities/ScratchArena.h"
+#include "Pomme.h"
+#include "PommeMemory.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+using namespace Pomme;
+
+// Scratch memory is cheaper to give up than purgeable resources, so let it go first.
+static constexpr int kScratchEvictionPriority = -1;
+
+// Chunks bypass zones and pointer tracking: the arena outlives any zone that's active
+// when a chunk is allocated, and retained chunks aren't leaks. They do count toward the memory budget.
+static constexpr size_t kChunkAlignment = Pomme::Memory::kCacheLineSize;
+
+static constexpr size_t kMinChunkSize = 64 * 1024;
+
+// Scopes that needed more than this (e.g. a whole decoded song) give their memory back when they end,
+// rather than making every later scope on the thread hold on to a chunk that large.
+static constexpr size_t kMaxRetainedChunkSize = 1024 * 1024;
+
+static std::mutex gArenasMutex;
+static std::vector<ScratchArena*> gArenas;
+static std::once_flag gRegisterEvictionCallbackOnce;
+
+//-----------------------------------------------------------------------------
+// Arena
+
+ScratchArena& ScratchArena::GetForCurrentThread()
+{
+	thread_local ScratchArena arena;
+	return arena;
+}
+
+ScratchArena::ScratchArena()
+	: currentChunk(0)
+	, offset(0)
+	, nextChunkSize(kMinChunkSize)
+	, scopeDepth(0)
+	, busy(false)
+{
+	std::call_once(gRegisterEvictionCallbackOnce, []()
+	{
+		Pomme_RegisterEvictionCallback(EvictionProc, nullptr, kScratchEvictionPriority);
+	});
+
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+	gArenas.push_back(this);
+}
+
+ScratchArena::~ScratchArena()
+{
+	// Once we're off the list, the eviction callback can't get to us anymore
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+	gArenas.erase(std::find(gArenas.begin(), gArenas.end(), this));
+	ReleaseChunks();
+}
+
+void ScratchArena::Enter()
+{
+	if (scopeDepth++ == 0)
+	{
+		// The eviction callback only holds on to the arena briefly
+		while (busy.exchange(true, std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+}
+
+void ScratchArena::Leave(Mark mark)
+{
+	currentChunk = mark.chunk;
+	offset = mark.offset;
+
+	if (--scopeDepth == 0)
+	{
+		size_t totalSize = 0;
+		for (const auto& chunk : chunks)
+			totalSize += chunk.size;
+
+		// If this scope needed several chunks, replace them with a single chunk
+		// that's large enough for subsequent scopes to get by without allocating.
+		if (chunks.size() > 1 || totalSize > kMaxRetainedChunkSize)
+		{
+			ReleaseChunks();
+			nextChunkSize = std::min(totalSize, kMaxRetainedChunkSize);
+		}
+		else
+		{
+			nextChunkSize = std::min(nextChunkSize, kMaxRetainedChunkSize);
+		}
+
+		busy.store(false, std::memory_order_release);
+	}
+}
+
+void* ScratchArena::Allocate(size_t size, size_t alignment)
+{
+	while (true)
+	{
+		for (; currentChunk < chunks.size(); currentChunk++, offset = 0)
+		{
+			const Chunk& chunk = chunks[currentChunk];
+			uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+			size_t alignedOffset = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+
+			if (alignedOffset + size <= chunk.size)
+			{
+				offset = alignedOffset + size;
+				return chunk.data + alignedOffset;
+			}
+		}
+
+		size_t chunkSize = std::max(nextChunkSize, size + alignment);
+		nextChunkSize = 2 * chunkSize;
+
+		char* data = (char*) Pomme::Memory::AllocInternalBuffer(chunkSize, kChunkAlignment, true);
+		chunks.push_back({ data, chunkSize });
+		currentChunk = chunks.size() - 1;
+		offset = 0;
+	}
+}
+
+void* ScratchArena::Extend(void* p, size_t oldSize, size_t newSize, size_t alignment)
+{
+	if (newSize <= oldSize)
+	{
+		return p;
+	}
+
+	// Grow in place if p is the topmost allocation and there's room left in its chunk
+	if (p && currentChunk < chunks.size())
+	{
+		const Chunk& chunk = chunks[currentChunk];
+		char* bytes = static_cast<char*>(p);
+		if (bytes + oldSize == chunk.data + offset
+			&& size_t(bytes - chunk.data) + newSize <= chunk.size)
+		{
+			offset += newSize - oldSize;
+			return p;
+		}
+	}
+
+	void* newP = Allocate(newSize, alignment);
+	if (p)
+		memcpy(newP, p, oldSize);
+	return newP;
+}
+
+void ScratchArena::ReleaseChunks()
+{
+	for (const auto& chunk : chunks)
+		Pomme::Memory::FreeInternalBuffer(chunk.data, chunk.size, kChunkAlignment, true);
+
+	chunks.clear();
+	currentChunk = 0;
+	offset = 0;
+}
+
+void ScratchArena::EvictionProc(Size bytesNeeded, void*)
+{
+	std::lock_guard<std::mutex> lock(gArenasMutex);
+
+	Size freed = 0;
+
+	for (ScratchArena* arena : gArenas)
+	{
+		// Skip arenas that are in use (including the calling thread's, if it's allocating from within a scope)
+		if (arena->busy.exchange(true, std::memory_order_acquire))
+			continue;
+
+		for (const auto& chunk : arena->chunks)
+			freed += Size(chunk.size);
+
+		arena->ReleaseChunks();
+		arena->busy.store(false, std::memory_order_release);
+
+		if (freed >= bytesNeeded)
+			break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Scope
+
+ScratchScope::ScratchScope()
+	: arena(ScratchArena::GetForCurrentThread())
+{
+	arena.Enter();
+	mark = { arena.currentChunk, arena.offset };
+}
+
+ScratchScope::~ScratchScope()
+{
+	arena.Leave(mark);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "PommeTypes.h"
+
+namespace Pomme
+{
+	// Per-thread bump allocator for short-lived decoder temporaries.
+	//
+	// Memory can only be obtained through a ScratchScope. Everything allocated within a scope
+	// is released at once when the scope ends, but the arena hangs on to its chunks so that
+	// subsequent decodes do no heap allocation once the arena has warmed up.
+	// Chunks are only kept across scopes up to a modest size; larger ones are freed when the scope ends.
+	//
+	// Chunks that aren't in use by any scope are given back when the heap exceeds
+	// the memory budget (see Pomme_SetMemoryBudget).
+	class ScratchArena
+	{
+		friend class ScratchScope;
+
+		struct Chunk
+		{
+			char* data;
+			size_t size;
+		};
+
+		struct Mark
+		{
+			size_t chunk;
+			size_t offset;
+		};
+
+		std::vector<Chunk> chunks;
+		size_t currentChunk;
+		size_t offset;
+		size_t nextChunkSize;
+		int scopeDepth;
+
+		// Held by the owning thread while a scope is open, or by the eviction callback while it's trimming the arena.
+		std::atomic<bool> busy;
+
+		ScratchArena();
+		~ScratchArena();
+
+		void Enter();
+		void Leave(Mark mark);
+		void* Allocate(size_t size, size_t alignment);
+		void* Extend(void* p, size_t oldSize, size_t newSize, size_t alignment);
+		void ReleaseChunks();
+		static void EvictionProc(Size bytesNeeded, void* userData);
+
+	public:
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		static ScratchArena& GetForCurrentThread();
+	};
+
+	// Scratch memory allocated through a scope lives until the scope ends. Scopes may be nested.
+	// Only trivial types may be allocated, and their contents are left uninitialized.
+	class ScratchScope
+	{
+		ScratchArena& arena;
+		ScratchArena::Mark mark;
+
+	public:
+		ScratchScope();
+		~ScratchScope();
+
+		ScratchScope(const ScratchScope&) = delete;
+		ScratchScope& operator=(const ScratchScope&) = delete;
+
+		template<typename T>
+		T* AllocArray(size_t count)
+		{
+			static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+			return static_cast<T*>(arena.Allocate(count * sizeof(T), alignof(T)));
+		}
+
+		template<typename T>
+		T* AllocArrayClear(size_t count)
+		{
+			T* array = AllocArray<T>(count);
+			memset(static_cast<void*>(array), 0, count * sizeof(T));
+			return array;
+		}
+
+		// Resizes an array obtained from this scope, preserving its contents.
+		// If it's the most recent allocation in the arena, it grows in place whenever possible.
+		template<typename T>
+		T* GrowArray(T* array, size_t oldCount, size_t newCount)
+		{
+			static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+			return static_cast<T*>(arena.Extend(array, oldCount * sizeof(T), newCount * sizeof(T), alignof(T)));
+		}
+	};
+}
@@ -1,5 +1,7 @@
 #include "memstream.h"
 
+#include <algorithm>
+
 //-----------------------------------------------------------------------------
 // membuf
 
@@ -20,39 +22,33 @@ std::streambuf::pos_type membuf::seekoff(off_type off, std::ios_base::seekdir di
 {
 	pos_type ret = 0;
 
-	if ((which & std::ios_base::in) > 0)
+	// Seeking before the start fails; seeking past the end parks the position at the end,
+	// so that the next read hits EOF like it would on a file.
+	auto Resolve = [&](char* current) -> off_type
 	{
-		if (dir == std::ios_base::cur)
-		{
-			gbump((int32_t) off);
-		}
-		else if (dir == std::ios_base::end)
-		{
-			setg(begin, end + off, end);
-		}
-		else if (dir == std::ios_base::beg)
-		{
-			setg(begin, begin + off, end);
-		}
+		off_type base = dir == std::ios_base::cur ? current - begin
+			: dir == std::ios_base::end ? end - begin
+			: 0;
+		off_type target = base + off;
+		return target < 0 ? -1 : std::min<off_type>(target, end - begin);
+	};
 
+	if ((which & std::ios_base::in) > 0)
+	{
+		off_type newPos = Resolve(gptr());
+		if (newPos < 0)
+			return pos_type(off_type(-1));
+		setg(begin, begin + newPos, end);
 		ret = gptr() - eback();
 	}
 
 	if ((which & std::ios_base::out) > 0)
 	{
-		if (dir == std::ios_base::cur)
-		{
-			pbump((int32_t) off);
-		}
-		else if (dir == std::ios_base::end)
-		{
-			setp(begin, end + off);
-		}
-		else if (dir == std::ios_base::beg)
-		{
-			setp(begin, begin + off);
-		}
-
+		off_type newPos = Resolve(pptr());
+		if (newPos < 0)
+			return pos_type(off_type(-1));
+		setp(begin, end);
+		pbump((int) newPos);
 		ret = pptr() - pbase();
 	}
 
@@ -309,7 +309,7 @@ static void Parse_mdia_soun(Pomme::BigEndianIStream& f, Movie& movie)
 		compressedLength += chunkBytes;
 	}
 
-	std::vector<char> compressedSoundData;
+	Pomme::Memory::AlignedVector<char> compressedSoundData;
 	compressedSoundData.reserve(compressedLength);
 	char* out = compressedSoundData.data();
 